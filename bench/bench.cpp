@@ -0,0 +1,340 @@
+#include "bench.h"
+
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <set>
+
+#include "RC_Engine.h"
+#include "map_gen.h"
+
+extern uint32_t temp_map[8 * 8];
+
+#define SPRITE_KEY 0x980088ff
+
+/* threads <= 0 keeps Core's default of one worker per hardware thread. */
+rc::Core_bench::Core_bench(size_t proj_plane_w, size_t proj_plane_h, int threads) : Core(proj_plane_w, proj_plane_h, FOV){
+	if(threads > 0) set_threads(threads);
+}
+
+void rc::Core_bench::set_map(const std::vector<uint32_t>& values, int w, int h){
+	m_map = std::make_unique<Map>(&values[0], w, h);
+	index_sprites();
+	reset_visited();
+}
+
+void rc::Core_bench::set_camera(const Vec2f& position, double viewing_angle){
+	viewing_angle = fmod(viewing_angle, 360.0);
+	if(viewing_angle < 0.0) viewing_angle += 360.0;
+
+	m_player->position = position;
+	m_player->viewing_angle = viewing_angle;
+	compute_view();
+}
+
+void rc::Core_bench::set_sprites(const std::vector<Vec2f>& positions){
+	m_sprites.clear();
+	m_sprites.reserve(positions.size());
+	for(size_t i = 0; i < positions.size(); i++){
+		m_sprites.add(positions[i], bench_sprite_texture(i));
+	}
+	index_sprites();
+}
+
+/* Same wall top and bottom row for every column, for timing the floor and ceiling rows alone. */
+void rc::Core_bench::set_wall_extents(int wall_top, int wall_bot){
+	for(int x = 0; x < m_proj_plane_w; x++){
+		set_floor_column(x, wall_top, wall_bot);
+	}
+}
+
+SDL_Rect rc::Core_bench::sprite_rect(size_t i){
+	auto screen_coords = sprite_world_2_screen(m_sprites.position(i));
+	double dist_to_sprite = (m_sprites.position(i) - m_player->position).length();
+	return sprite_screen_dimensions(screen_coords.x, dist_to_sprite);
+}
+
+int rc::bench_sprite_texture(size_t i){
+	static const int ids[3] = {BARREL_SPRITE, ENEMY_SPRITE, DOOM_SPRITE};
+	return ids[i % 3];
+}
+
+static SDL_Surface * make_texture(uint32_t a, uint32_t b, int cell, bool keyed){
+	SDL_Surface * s;
+	RC_DIE(!(s = SDL_CreateRGBSurfaceWithFormat(0, 64, 64, 32, SDL_PIXELFORMAT_RGBA8888)), SDL_GetError());
+
+	uint32_t * pixels = reinterpret_cast<uint32_t *>(s->pixels);
+	for(int y = 0; y < 64; y++){
+		for(int x = 0; x < 64; x++){
+			uint32_t color = (((x / cell) + (y / cell)) & 1) ? a : b;
+			// shade so neighbouring texels differ, a flat color would hide sampling bugs.
+			color ^= static_cast<uint32_t>((x * 3 + y * 5) & 0x3f) << 8;
+
+			// sprites get a transparent border, like the real barrel and doom guy.
+			if(keyed && (x < 12 || x >= 52 || y < 4)){
+				color = SPRITE_KEY;
+			}
+			pixels[y * (s->pitch / 4) + x] = color;
+		}
+	}
+
+	if(keyed){
+		RC_DIE((SDL_SetColorKey(s, SDL_TRUE, SPRITE_KEY) < 0), SDL_GetError());
+	}
+
+	return s;
+}
+
+void rc::load_bench_textures(){
+	Resources * r = Resources::instance();
+
+	r->add_surface(FLOOR_TEXT, make_texture(0x404040ff, 0x606060ff, 8, false));
+	r->add_surface(SPACE_WALL_TEXT, make_texture(0x2040a0ff, 0x3060c0ff, 16, false));
+	r->add_surface(WOLF_WALL_TEXT, make_texture(0x808080ff, 0xa0a0a0ff, 32, false));
+	r->add_surface(CEILING_TEXT, make_texture(0x503020ff, 0x705030ff, 4, false));
+	r->add_surface(BARREL_SPRITE, make_texture(0x20a020ff, 0x40c040ff, 8, true));
+	r->add_surface(ENEMY_SPRITE, make_texture(0xa02020ff, 0xc04040ff, 8, true));
+	r->add_surface(DOOM_SPRITE, make_texture(0xa0a020ff, 0xc0c040ff, 8, true));
+	r->build_atlas();
+}
+
+static std::vector<uint32_t> walled_room(int w, int h){
+	std::vector<uint32_t> values(w * h, FLCL(0, 0, 3));
+	for(int y = 0; y < h; y++){
+		for(int x = 0; x < w; x++){
+			if(x == 0 || y == 0 || x == w - 1 || y == h - 1){
+				values[y * w + x] = WALL(2);
+			}
+		}
+	}
+	return values;
+}
+
+/* world coordinate of the center of cell c, along either axis */
+static double cell_center(int c){ return c * CELL_SIZE + CELL_SIZE / 2; }
+
+/*
+ * Bench map from the generator. The camera turns once on the spawn cell and then walks the
+ * shortest path to the floor cell farthest from it, through cell centers so it never clips
+ * a wall. Sprites standing on that path are dropped, the camera would walk right through them.
+ * */
+static rc::Bench_map generated(const char * name, const rc::Map_gen_params& params){
+	auto gen = rc::generate_map(params);
+	int w = gen.map.w;
+	int h = gen.map.h;
+
+	rc::Bench_map map;
+	map.name = name;
+	map.w = w;
+	map.h = h;
+	map.values = gen.map.row_major();
+
+	int start = static_cast<int>(gen.spawn.y / CELL_SIZE) * w + static_cast<int>(gen.spawn.x / CELL_SIZE);
+	std::vector<int> parent(w * h, -1);
+	std::queue<int> q;
+	int last = start;
+
+	parent[start] = start;
+	q.push(start);
+	while(!q.empty()){
+		last = q.front();
+		q.pop();
+
+		int neighbours[4] = {last - 1, last + 1, last - w, last + w};
+		for(int n : neighbours){
+			if(parent[n] < 0 && (map.values[n] & FLOOR_CEIL_BIT)){
+				parent[n] = last;
+				q.push(n);
+			}
+		}
+	}
+
+	std::vector<int> cells;
+	for(int c = last; c != start; c = parent[c]) cells.push_back(c);
+	cells.push_back(start);
+	std::reverse(cells.begin(), cells.end());
+
+	double angle = 0.0;
+	map.path.push_back({cell_center(start % w), cell_center(start / w), angle});
+	angle += 360.0;
+	map.path.push_back({cell_center(start % w), cell_center(start / w), angle});
+
+	for(size_t i = 1; i < cells.size(); i++){
+		int dx = cells[i] % w - cells[i - 1] % w;
+		int dy = cells[i] / w - cells[i - 1] / w;
+		double heading = rc::to_deg(atan2(-dy, dx));
+
+		// turn the short way round so the interpolation doesn't spin
+		double turn = fmod(heading - angle, 360.0);
+		if(turn > 180.0) turn -= 360.0;
+		if(turn < -180.0) turn += 360.0;
+		angle += turn;
+
+		map.path.push_back({cell_center(cells[i] % w), cell_center(cells[i] / w), angle});
+	}
+
+	std::set<int> on_path(cells.begin(), cells.end());
+	for(const auto& s : gen.sprites){
+		int cell = static_cast<int>(s.y / CELL_SIZE) * w + static_cast<int>(s.x / CELL_SIZE);
+		if(!on_path.count(cell)) map.sprites.push_back(s);
+	}
+
+	return map;
+}
+
+std::vector<rc::Bench_map> rc::bench_maps(){
+	std::vector<Bench_map> maps;
+
+	Bench_map temp;
+	temp.name = "temp_map";
+	temp.w = 8;
+	temp.h = 8;
+	temp.values = std::vector<uint32_t>(temp_map, temp_map + 8 * 8);
+	temp.sprites = {Vec2f(100, 100), Vec2f(150, 200)};
+	temp.path = {{cell_center(1), cell_center(4), 0.0},
+				 {cell_center(1), cell_center(4), 360.0},
+				 {cell_center(6), cell_center(4), 360.0},
+				 {cell_center(6), cell_center(1), 450.0}};
+	maps.push_back(temp);
+
+	Bench_map open;
+	open.name = "open_32";
+	open.w = 32;
+	open.h = 32;
+	open.values = walled_room(32, 32);
+	for(int i = 0; i < 16; i++){
+		double a = to_rad(i * (360.0 / 16));
+		open.sprites.push_back(Vec2f(cell_center(16) + cos(a) * 10 * CELL_SIZE,
+									 cell_center(16) + sin(a) * 10 * CELL_SIZE));
+	}
+	for(int i = 0; i <= 8; i++){
+		double a = to_rad(i * 45.0);
+		open.path.push_back({cell_center(16) + cos(a) * 5 * CELL_SIZE,
+							 cell_center(16) - sin(a) * 5 * CELL_SIZE,
+							 i * 45.0 + 90.0});
+	}
+	maps.push_back(open);
+
+	Bench_map pillars;
+	pillars.name = "pillars_64";
+	pillars.w = 64;
+	pillars.h = 64;
+	pillars.values = walled_room(64, 64);
+	for(int y = 4; y < 64 - 1; y += 4){
+		for(int x = 4; x < 64 - 1; x += 4){
+			pillars.values[y * 64 + x] = WALL(1);
+			pillars.sprites.push_back(Vec2f(cell_center(x - 2), cell_center(y - 2)));
+		}
+	}
+	// walks the rows and columns between pillars, clear of the sprites.
+	pillars.path = {{cell_center(1), cell_center(1), 0.0},
+					{cell_center(61), cell_center(1), 90.0},
+					{cell_center(61), cell_center(29), 270.0},
+					{cell_center(1), cell_center(29), 540.0}};
+	maps.push_back(pillars);
+
+	rc::Map_gen_params maze;
+	maze.seed = 7;
+	maze.corridor_length = 6;
+	maze.open_ratio = 0.1;
+	maze.wall_density = 0.02;
+	maze.sprites = 128;
+	maps.push_back(generated("maze_64", maze));
+
+	rc::Map_gen_params rooms;
+	rooms.seed = 11;
+	rooms.corridor_length = 2;
+	rooms.open_ratio = 0.7;
+	rooms.wall_density = 0.08;
+	rooms.sprites = 1024;
+	maps.push_back(generated("rooms_64", rooms));
+
+	// open enough that rays cross hundreds of cells, and dozens of chunks, before they hit anything.
+	rc::Map_gen_params hall;
+	hall.w = 1024;
+	hall.h = 1024;
+	hall.seed = 13;
+	hall.open_ratio = 1.0;
+	hall.wall_density = 0.002;
+	hall.sprites = 4096;
+	maps.push_back(generated("hall_1024", hall));
+
+	return maps;
+}
+
+rc::Frame_stats::Frame_stats(std::vector<double> samples) : sorted(std::move(samples)){
+	std::sort(sorted.begin(), sorted.end());
+	total = 0.0;
+	for(double s : sorted) total += s;
+}
+
+double rc::Frame_stats::percentile(double p) const {
+	if(sorted.empty()) return 0.0;
+	size_t i = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+	return sorted[std::min(i, sorted.size() - 1)];
+}
+
+uint64_t rc::checksum(const uint32_t * pixels, size_t len){
+	// FNV-1a over the words
+	uint64_t hash = 14695981039346656037ull;
+	for(size_t i = 0; i < len; i++){
+		hash ^= pixels[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static const struct{ const char * name; uint32_t flag; } flag_names[] = {
+	{"raw", rc::DRAW_RAW_WALLS},
+	{"textured", rc::DRAW_TEXT_MAPPED_WALLS},
+	{"dda", rc::TRAVERSAL_DDA},
+	{"packet", rc::TRAVERSAL_PACKET},
+	{"columns", rc::TARGET_COLUMN_MAJOR},
+	{"mipmaps", rc::TEXTURE_MIPMAPS},
+	{"pvs", rc::VISIBILITY_PVS},
+	{"layers", rc::LAYERED_SCENE},
+	{"reproject", rc::REPROJECT_ROTATION},
+};
+
+uint32_t rc::parse_render_flags(const char * names){
+	uint32_t flags = 0;
+	std::string s(names);
+	size_t start = 0;
+
+	while(start < s.size()){
+		size_t end = s.find(',', start);
+		if(end == std::string::npos) end = s.size();
+
+		std::string name = s.substr(start, end - start);
+		bool found = false;
+		for(const auto& f : flag_names){
+			if(name == f.name){
+				flags |= f.flag;
+				found = true;
+			}
+		}
+		RC_DIE(!found, "unknown render flag");
+		start = end + 1;
+	}
+
+	return flags;
+}
+
+std::string rc::render_flag_names(uint32_t flags){
+	std::string names;
+	for(const auto& f : flag_names){
+		if(flags & f.flag){
+			if(!names.empty()) names += ",";
+			names += f.name;
+		}
+	}
+	return names;
+}
+
+rc::Packet_isa rc::parse_packet_isa(const char * name){
+	for(int isa = PACKET_SCALAR; isa <= PACKET_AVX2; isa++){
+		if(!strcmp(name, packet_isa_name(static_cast<Packet_isa>(isa)))) return static_cast<Packet_isa>(isa);
+	}
+	RC_DIE(true, "unknown packet isa");
+	return PACKET_SCALAR;
+}
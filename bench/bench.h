@@ -0,0 +1,83 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "RC_Core.h"
+
+namespace rc{
+	/* Core without a window or an SDL_Renderer. Engine is the only other subclass of Core,
+	 * this one just lets the benchmarks swap the map, place the camera and the sprites
+	 * and call render() in a tight loop.*/
+	struct Core_bench : public Core{
+		Core_bench(size_t proj_plane_w, size_t proj_plane_h, int threads);
+
+		void set_map(const std::vector<uint32_t>& values, int w, int h);
+		void set_map(const Map& map) { m_map = std::make_unique<Map>(map); index_sprites(); reset_visited(); };
+		void set_camera(const Vec2f& position, double viewing_angle);
+		void set_sprites(const std::vector<Vec2f>& positions);
+		using Core::load_map;
+		void set_pvs(std::shared_ptr<const Pvs> pvs) { m_map->pvs = std::move(pvs); sprites_changed(); };
+
+		/* Kernel entry points for bench_kernels, Core_bench is a friend of Core. */
+		using Ray_hit = Core::Ray_hit;
+		double trace_h(double ray_angle, Vec2f& hit, Vec2i& map_coords) { return find_h_intercept(ray_angle, hit, map_coords, 0); };
+		double trace_v(double ray_angle, Vec2f& hit, Vec2i& map_coords) { return find_v_intercept(ray_angle, hit, map_coords, 0); };
+		Ray_hit trace_dda(double ray_angle) { return cast_ray_dda(Vec2f(cos(to_rad(ray_angle)), -sin(to_rad(ray_angle))), 1.0, 0); };
+		void trace_columns(int x0, int x1, uint32_t flags, Ray_hit * hits) { cast_rays(x0, x1, flags, hits, 0); };
+		void wall_slice(int texture_x, int slice_height, int x, const Texture& texture, bool mipmapped) { draw_textmapped_wall_slice(texture_x, slice_height, x, texture, mipmapped); };
+		void set_wall_extents(int wall_top, int wall_bot);
+		void floor_row(int y, uint32_t flags) { draw_floor_row(y, flags); };
+		void ceiling_row(int y, uint32_t flags) { draw_ceiling_row(y, flags); };
+		void sprite_draw(int texture_id, const SDL_Rect& dim, bool mipmapped) { draw_sprite(texture_id, dim, 1.0, 0, m_proj_plane_w, mipmapped); };
+		SDL_Rect sprite_rect(size_t i);
+		void clear_depth() { std::fill(m_wall_dists.begin(), m_wall_dists.end(), DBL_MAX); };
+
+		constexpr int plane_center() const { return m_proj_plane_center; };
+		const Player& player() const { return *m_player; };
+		const Map& map() const { return *m_map; };
+		Sprites& sprites() { return m_sprites; };
+	};
+
+	struct Bench_map{
+		std::string name;
+		int w;
+		int h;
+		std::vector<uint32_t> values;
+		std::vector<Vec2f> sprites;
+
+		/* camera path, keyframes are interpolated linearly. */
+		struct Key{ double x, y, angle; };
+		std::vector<Key> path;
+	};
+
+	/* Procedural textures, loaded straight into rc::Resources under the TextureID slots
+	 * the maps reference. No files and no renderer needed, so runs are reproducible.*/
+	void load_bench_textures();
+
+	/* Texture of the i-th sprite of a bench map, the three sprite textures in turn.*/
+	int bench_sprite_texture(size_t i);
+
+	std::vector<Bench_map> bench_maps();
+
+	struct Frame_stats{
+		Frame_stats(std::vector<double> samples);
+		double percentile(double p) const;
+
+		public:
+			std::vector<double> sorted; // frame times in ms
+			double total;
+	};
+
+	inline double elapsed_ms(std::chrono::steady_clock::time_point start){
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	uint64_t checksum(const uint32_t * pixels, size_t len);
+
+	/* Comma separated RenderFlag names ("raw", "textured", "dda", ...) to flags and back. */
+	uint32_t parse_render_flags(const char * names);
+	std::string render_flag_names(uint32_t flags);
+	Packet_isa parse_packet_isa(const char * name);
+}
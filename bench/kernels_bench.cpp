@@ -0,0 +1,538 @@
+/*
+ * Microbenchmarks for the individual raycasting kernels of rc::Core.
+ *
+ * Each kernel is run in isolation over a sweep of map size, wall density, ray angle
+ * distribution and slice height, and reported as ns/ray, ns/pixel and the bytes each
+ * call touches (map cells read, texels sampled and framebuffer pixels written), so a
+ * slow frame can be pinned on traversal, texture sampling or sprite overdraw.
+ *
+ * Kernels run on one thread unless --threads says otherwise.
+ *
+ * usage: bench_kernels [--threads n] [--kernel name]
+ * */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <random>
+
+#include "bench.h"
+#include "RC_Engine.h"
+#include "map_file.h"
+#include "map_gen.h"
+#include "pool.h"
+#include "transpose.h"
+
+#define PLANE_W 800
+#define PLANE_H 600
+#define MIN_BENCH_MS 20.0
+#define RAYS_PER_BATCH 4096
+
+enum Angle_dist{
+	ANGLES_FOV,     // one frame worth of columns, the real access pattern.
+	ANGLES_UNIFORM, // anywhere on the circle.
+	ANGLES_AXIS,    // within a degree of 0/90/180/270, the traversal's worst case.
+};
+
+static const char * angle_dist_names[] = {"fov", "uniform", "axis"};
+
+static const char * kernel_filter = NULL;
+static int threads = 1;
+static volatile double sink;
+
+struct Result{
+	const char * kernel;
+	char params[64];
+	double ns_per_call;
+	double rays;    // per call
+	double pixels;  // per call
+	double bytes;   // per call
+};
+
+static void print_header(){
+	printf("%-14s %-32s %10s %9s %9s %11s\n", "kernel", "params", "ns/call", "ns/ray", "ns/px", "bytes/call");
+}
+
+static void print(const Result& r){
+	char ray[16] = "-", px[16] = "-";
+
+	if(r.rays > 0) snprintf(ray, sizeof(ray), "%.2f", r.ns_per_call / r.rays);
+	if(r.pixels > 0) snprintf(px, sizeof(px), "%.3f", r.ns_per_call / r.pixels);
+
+	printf("%-14s %-32s %10.1f %9s %9s %11.0f\n", r.kernel, r.params, r.ns_per_call, ray, px, r.bytes);
+}
+
+static bool enabled(const char * kernel){
+	return kernel_filter == NULL || !strcmp(kernel_filter, kernel);
+}
+
+/* Runs f (one call over n units) until MIN_BENCH_MS has passed, returns ns per unit. */
+template<typename F>
+static double time_ns(F f, int n){
+	f(); // warm up caches and branch predictors
+
+	long reps = 0;
+	auto start = std::chrono::steady_clock::now();
+	double ms;
+
+	do{
+		f();
+		reps++;
+	}while((ms = rc::elapsed_ms(start)) < MIN_BENCH_MS);
+
+	return (ms * 1e6) / (static_cast<double>(reps) * n);
+}
+
+/* One open hall with pillars scattered at the given density. */
+static rc::Generated_map random_map(int size, double density, int sprites){
+	rc::Map_gen_params params;
+	params.w = size;
+	params.h = size;
+	params.open_ratio = 1.0;
+	params.wall_density = density;
+	params.sprites = sprites;
+	return rc::generate_map(params);
+}
+
+static std::vector<double> ray_angles(Angle_dist dist, double viewing_angle, int n, uint32_t seed){
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<double> u(0.0, 1.0);
+	std::vector<double> angles(n);
+
+	for(int i = 0; i < n; i++){
+		double a;
+		switch(dist){
+			case ANGLES_FOV: a = viewing_angle + FOV * 0.5 - (FOV * static_cast<double>(i % PLANE_W)) / PLANE_W; break;
+			case ANGLES_UNIFORM: a = u(rng) * 360.0; break;
+			default: a = 90.0 * (i % 4) + (u(rng) * 2.0 - 1.0); break; // ANGLES_AXIS
+		}
+
+		if(a >= 360.0) a -= 360.0;
+		if(a < 0.0) a += 360.0;
+		angles[i] = a;
+	}
+	return angles;
+}
+
+/* Map cells the walk read before stopping, every step reads one cell and marks its visited byte. */
+static double walk_bytes(double dist, double travelled){
+	if(dist == DBL_MAX && travelled == 0.0) return 0.0;
+	double reads = floor(travelled / CELL_SIZE) + 1.0;
+	return reads * sizeof(uint32_t) + (reads - 1.0) * sizeof(uint8_t);
+}
+
+static void bench_traversal(){
+	if(!enabled("h_intercept") && !enabled("v_intercept") && !enabled("dda") && !enabled("packet")) return;
+
+	// the walks cost the same on the large maps, only the cells they cross are touched.
+	for(int size : {16, 32, 64, 1024, 4096}){
+		for(double density : {0.05, 0.25, 0.5}){
+			rc::Core_bench core(PLANE_W, PLANE_H, threads);
+			auto gen = random_map(size, density, 0);
+			core.set_map(gen.map);
+			core.set_camera(gen.spawn, 45.0);
+
+			for(int d = ANGLES_FOV; d <= ANGLES_AXIS; d++){
+				auto angles = ray_angles(static_cast<Angle_dist>(d), 45.0, RAYS_PER_BATCH, 2);
+				rc::Vec2f hit;
+				rc::Vec2i coords;
+				const rc::Vec2f& p = core.player().position;
+
+				for(int h = 0; h < 2; h++){
+					const char * kernel = h ? "h_intercept" : "v_intercept";
+					if(!enabled(kernel)) continue;
+
+					double bytes = 0.0;
+					for(double a : angles){
+						double dist = h ? core.trace_h(a, hit, coords) : core.trace_v(a, hit, coords);
+						bytes += walk_bytes(dist, h ? fabs(hit.y - p.y) : fabs(hit.x - p.x));
+					}
+
+					Result r = {kernel, "", 0.0, 1.0, 0.0, bytes / RAYS_PER_BATCH};
+					snprintf(r.params, sizeof(r.params), "map=%d density=%.2f rays=%s", size, density, angle_dist_names[d]);
+
+					r.ns_per_call = time_ns([&](){
+						double acc = 0.0;
+						for(double a : angles){
+							acc += h ? core.trace_h(a, hit, coords) : core.trace_v(a, hit, coords);
+						}
+						sink = acc;
+					}, RAYS_PER_BATCH);
+
+					print(r);
+				}
+
+				if(enabled("dda")){
+					double bytes = 0.0;
+					for(double a : angles){
+						auto hit = core.trace_dda(a);
+						// one map read per cell entered, cells crossed is the taxicab length in cells
+						double reads = floor(fabs(hit.point.x - p.x) / CELL_SIZE) + floor(fabs(hit.point.y - p.y) / CELL_SIZE) + 1.0;
+						bytes += reads * sizeof(uint32_t) + (reads - 1.0) * sizeof(uint8_t);
+					}
+
+					Result r = {"dda", "", 0.0, 1.0, 0.0, bytes / RAYS_PER_BATCH};
+					snprintf(r.params, sizeof(r.params), "map=%d density=%.2f rays=%s", size, density, angle_dist_names[d]);
+
+					r.ns_per_call = time_ns([&](){
+						double acc = 0.0;
+						for(double a : angles){
+							acc += core.trace_dda(a).dist;
+						}
+						sink = acc;
+					}, RAYS_PER_BATCH);
+
+					print(r);
+				}
+			}
+
+			/* One frame of columns per call, packets only make sense for adjacent rays. The first
+			 * row is the scalar double precision dda over the same columns, the others report their
+			 * speedup over it.*/
+			if(enabled("packet")){
+				std::vector<rc::Core_bench::Ray_hit> hits(PLANE_W);
+				double base_ns = 0.0;
+
+				for(int isa = -1; isa <= rc::best_packet_isa(); isa++){
+					if(isa >= 0) core.set_packet_isa(static_cast<rc::Packet_isa>(isa));
+					uint32_t flags = isa < 0 ? rc::TRAVERSAL_DDA : rc::TRAVERSAL_PACKET;
+
+					Result r = {"packet", "", 0.0, PLANE_W, 0.0, 0.0};
+					r.ns_per_call = time_ns([&](){
+						core.trace_columns(0, PLANE_W, flags, &hits[0]);
+						sink = hits[PLANE_W / 2].dist;
+					}, 1);
+
+					if(base_ns == 0.0) base_ns = r.ns_per_call;
+					snprintf(r.params, sizeof(r.params), "map=%d density=%.2f %s x%.2f", size, density,
+							 isa < 0 ? "dda" : rc::packet_isa_name(static_cast<rc::Packet_isa>(isa)), base_ns / r.ns_per_call);
+					print(r);
+				}
+			}
+		}
+	}
+}
+
+static void bench_slices(){
+	const rc::Texture& wall = *rc::Resources::instance()->texture(rc::SPACE_WALL_TEXT);
+
+	rc::Core_bench core(PLANE_W, PLANE_H, threads);
+	auto gen = random_map(32, 0.1, 0);
+	core.set_map(gen.map);
+	core.set_camera(gen.spawn, 45.0);
+
+	int center = core.plane_center();
+
+	for(int slice_height : {16, 64, 300, 600, 2400}){
+		int wall_bot = std::min(PLANE_H - 1, center + slice_height / 2);
+		int wall_top = std::max(0, center - slice_height / 2);
+
+		if(enabled("floor_rows") || enabled("ceiling_rows")){
+			core.set_wall_extents(wall_top, wall_bot);
+		}
+
+		for(uint32_t flags : {0u, static_cast<uint32_t>(rc::TEXTURE_MIPMAPS)}){
+			const char * mip = flags ? " mip" : "";
+
+			if(enabled("wall_slice")){
+				double visible = std::min(slice_height, PLANE_H);
+				// one texel read and one framebuffer write per visible pixel
+				Result r = {"wall_slice", "", 0.0, 1.0, visible, visible * 2 * sizeof(uint32_t)};
+				snprintf(r.params, sizeof(r.params), "slice=%d%s", slice_height, mip);
+
+				r.ns_per_call = time_ns([&](){
+					for(int x = 0; x < PLANE_W; x++) core.wall_slice(x % 64, slice_height, x, wall, flags);
+				}, PLANE_W);
+				print(r);
+			}
+
+			// ns/call is per screen column, comparable with wall_slice.
+			if(enabled("floor_rows")){
+				double pixels = PLANE_H - wall_bot;
+				// map cell, texel and framebuffer pixel per floor pixel
+				Result r = {"floor_rows", "", 0.0, 1.0, pixels, pixels * 3 * sizeof(uint32_t)};
+				snprintf(r.params, sizeof(r.params), "slice=%d%s", slice_height, mip);
+
+				r.ns_per_call = time_ns([&](){
+					for(int y = wall_bot; y < PLANE_H; y++) core.floor_row(y, flags);
+				}, PLANE_W);
+				print(r);
+			}
+
+			if(enabled("ceiling_rows")){
+				double pixels = wall_top + 1;
+				Result r = {"ceiling_rows", "", 0.0, 1.0, pixels, pixels * 3 * sizeof(uint32_t)};
+				snprintf(r.params, sizeof(r.params), "slice=%d%s", slice_height, mip);
+
+				r.ns_per_call = time_ns([&](){
+					for(int y = 0; y <= wall_top; y++) core.ceiling_row(y, flags);
+				}, PLANE_W);
+				print(r);
+			}
+		}
+	}
+}
+
+static void bench_sprite_draw(){
+	if(!enabled("sprite_draw")) return;
+
+	rc::Core_bench core(PLANE_W, PLANE_H, threads);
+	core.set_sprites({rc::Vec2f(0, 0)});
+	core.clear_depth();
+
+	for(int size : {16, 64, 300, 600, 1200}){
+		for(bool mipmapped : {false, true}){
+			SDL_Rect dim = {PLANE_W / 2 - size / 2, core.plane_center() - size / 2, size, size};
+			double pixels = static_cast<double>(std::min(size, PLANE_W)) * std::min(size, PLANE_H);
+
+			Result r = {"sprite_draw", "", 0.0, 0.0, pixels, pixels * 2 * sizeof(uint32_t)};
+			snprintf(r.params, sizeof(r.params), "size=%d%s", size, mipmapped ? " mip" : "");
+
+			r.ns_per_call = time_ns([&](){ core.sprite_draw(core.sprites().texture_id[0], dim, mipmapped); }, 1);
+			print(r);
+		}
+	}
+}
+
+static void bench_render_sprites(){
+	if(!enabled("render_sprites")) return;
+
+	for(int count : {16, 128, 1024, 16384}){
+		auto gen = random_map(64, 0.1, count);
+
+		rc::Core_bench core(PLANE_W, PLANE_H, threads);
+		core.set_map(gen.map);
+		core.set_camera(gen.spawn, 45.0);
+
+		core.set_sprites(gen.sprites);
+
+		// screen area the sprites cover before the depth test, an upper bound on overdraw
+		double pixels = 0.0;
+		for(size_t i = 0; i < core.sprites().size(); i++){
+			SDL_Rect d = core.sprite_rect(i);
+			int x0 = std::max(0, d.x), x1 = std::min(PLANE_W, d.x + d.w);
+			int y0 = std::max(0, d.y), y1 = std::min(PLANE_H, d.y + d.h);
+			if(x1 > x0 && y1 > y0) pixels += static_cast<double>(x1 - x0) * (y1 - y0);
+		}
+
+		for(bool pvs : {false, true}){
+			uint32_t flags = rc::DRAW_TEXT_MAPPED_WALLS;
+			if(pvs){
+				rc::Workers workers(core.threads());
+				core.set_pvs(std::make_shared<rc::Pvs>(rc::build_pvs(gen.map, workers)));
+				flags |= rc::VISIBILITY_PVS;
+			}
+			core.render(flags); // real wall depths for the depth test, and the pvs set of the spawn
+
+			Result r = {"render_sprites", "", 0.0, 0.0, pixels, pixels * 2 * sizeof(uint32_t)};
+			snprintf(r.params, sizeof(r.params), "sprites=%d%s", count, pvs ? " pvs" : "");
+
+			r.ns_per_call = time_ns([&](){ core.render_sprites(flags); }, 1);
+			print(r);
+		}
+	}
+}
+
+/*
+ * Keeping the selected sprites in depth order, all of them here: the distance update plus the
+ * insertion sort from last call's order, for a camera walking a unit per call and one jumping
+ * anywhere, against a full std::sort of the order every call.
+ * */
+static void bench_sprite_order(){
+	if(!enabled("sprite_order")) return;
+
+	static const char * names[] = {"walk", "jump", "std::sort"};
+	for(int count : {1024, 4096, 16384, 65536}){
+		std::mt19937 rng(count);
+		std::uniform_real_distribution<double> u(0.0, 256.0 * CELL_SIZE);
+
+		rc::Sprites sprites;
+		std::vector<uint32_t> all(count);
+		for(int i = 0; i < count; i++){
+			sprites.add(rc::Vec2f(u(rng), u(rng)), rc::bench_sprite_texture(i));
+			all[i] = i;
+		}
+		sprites.select(all.data(), all.size());
+
+		for(int kind = 0; kind < 3; kind++){
+			Result r = {"sprite_order", "", 0.0, 0.0, 0.0, count * (3.0 * sizeof(double) + sizeof(uint32_t))};
+			snprintf(r.params, sizeof(r.params), "sprites=%d %s", count, names[kind]);
+
+			rc::Vec2f p(128.0 * CELL_SIZE, 128.0 * CELL_SIZE);
+			r.ns_per_call = time_ns([&](){
+				p = kind == 1 ? rc::Vec2f(u(rng), u(rng)) : p + rc::Vec2f(1.0, 0.5);
+				sprites.update_distances(p);
+				if(kind == 2){
+					const double * d = sprites.dist.data();
+					std::sort(sprites.order.begin(), sprites.order.end(), [d](uint32_t a, uint32_t b){
+						return d[a] < d[b] || (d[a] == d[b] && a < b);
+					});
+				}else{
+					sprites.sort_by_distance();
+				}
+			}, 1);
+			print(r);
+		}
+	}
+}
+
+/* Building the potentially visible sets, once per level, over map size and wall density.*/
+static void bench_pvs_build(){
+	if(!enabled("pvs_build")) return;
+
+	rc::Workers workers(std::max(threads, 1));
+	for(int size : {32, 64, 128}){
+		for(double density : {0.05, 0.2}){
+			auto gen = random_map(size, density, 0);
+
+			Result r = {"pvs_build", "", 0.0, 0.0, 0.0, static_cast<double>(size) * size * sizeof(uint32_t)};
+			snprintf(r.params, sizeof(r.params), "size=%d density=%.2f", size, density);
+
+			r.ns_per_call = time_ns([&](){ sink = rc::build_pvs(gen.map, workers).bit_words; }, 1);
+			print(r);
+		}
+	}
+}
+
+/*
+ * A level load from row major values, copied into chunks with the sprites bucketed, against
+ * mapping the same level from a map file. Neither touches the cells afterwards, the map file's
+ * pages are faulted in by the first frames instead.
+ * */
+static void bench_map_load(){
+	if(!enabled("map_load")) return;
+
+	char path[] = "/tmp/rc_map_XXXXXX";
+	int fd = mkstemp(path);
+	RC_DIE(fd < 0, "can't create a temporary map file");
+	close(fd);
+
+	for(int size : {256, 1024, 4096}){
+		auto gen = random_map(size, 0.05, size);
+		auto values = gen.map.row_major();
+		std::vector<uint32_t> textures(gen.sprites.size(), rc::BARREL_SPRITE);
+		rc::save_map_file(path, gen.map, gen.spawn, gen.sprites, textures);
+
+		rc::Core_bench core(PLANE_W, PLANE_H, threads);
+		double cells = static_cast<double>(size) * size;
+
+		for(int file = 0; file < 2; file++){
+			Result r = {"map_load", "", 0.0, 0.0, 0.0, file ? 0.0 : cells * 2 * sizeof(uint32_t)};
+			snprintf(r.params, sizeof(r.params), "map=%d %s ns/cell=", size, file ? "mmap" : "values");
+
+			r.ns_per_call = time_ns([&](){
+				if(file){
+					core.load_map(rc::load_map_file(path));
+				}else{
+					core.set_map(values, size, size);
+					core.set_sprites(gen.sprites);
+				}
+			}, 1);
+
+			snprintf(r.params + strlen(r.params), sizeof(r.params) - strlen(r.params), "%.3f", r.ns_per_call / cells);
+			print(r);
+		}
+	}
+
+	unlink(path);
+}
+
+/* Column major to row major hand off at the bench_render resolutions, against a plain row copy. */
+static void bench_transpose(){
+	if(!enabled("transpose")) return;
+
+	for(auto res : {std::make_pair(320, 200), std::make_pair(800, 600), std::make_pair(1280, 720), std::make_pair(1920, 1080)}){
+		int w = res.first, h = res.second;
+		std::vector<uint32_t> src(w * h), dst(w * h);
+		for(size_t i = 0; i < src.size(); i++) src[i] = static_cast<uint32_t>(i * 2654435761u);
+
+		double pixels = static_cast<double>(w) * h;
+		for(int copy = 0; copy < 2; copy++){
+			Result r = {"transpose", "", 0.0, 0.0, pixels, pixels * 2 * sizeof(uint32_t)};
+			snprintf(r.params, sizeof(r.params), "%dx%d %s", w, h, copy ? "row copy" : "blocked");
+
+			r.ns_per_call = time_ns([&](){
+				if(copy){
+					memcpy(&dst[0], &src[0], src.size() * sizeof(uint32_t));
+				}else{
+					rc::transpose_pixels(&src[0], h, &dst[0], w, w, h);
+				}
+				sink = dst[w + 1];
+			}, 1);
+			print(r);
+		}
+	}
+}
+
+/* A 64 byte object made and dropped in a shuffled order, from the heap against a Pool and a Pool_cache. */
+struct Pool_object{
+	rc::Vec2f position;
+	rc::Vec2f velocity;
+	double data[4];
+
+	Pool_object(double x, double y) : position(x, y), velocity(0.0, 0.0), data{} {};
+};
+
+static void bench_pool(){
+	if(!enabled("pool")) return;
+
+	static const char * names[] = {"new/delete", "pool", "pool cache"};
+	for(int live : {256, 4096, 65536}){
+		std::vector<Pool_object *> objects(live);
+		std::vector<int> order(live);
+		for(int i = 0; i < live; i++) order[i] = i;
+		std::shuffle(order.begin(), order.end(), std::mt19937(live));
+
+		for(int kind = 0; kind < 3; kind++){
+			rc::Pool<Pool_object> pool;
+			rc::Pool_cache<Pool_object> cache(pool);
+
+			Result r = {"pool", "", 0.0, 0.0, 0.0, sizeof(Pool_object)};
+			snprintf(r.params, sizeof(r.params), "live=%d %s", live, names[kind]);
+
+			// ns per object made and dropped.
+			r.ns_per_call = time_ns([&](){
+				for(int i = 0; i < live; i++){
+					if(kind == 0) objects[i] = new Pool_object(i, i);
+					else if(kind == 1) objects[i] = pool.create(i, i);
+					else objects[i] = cache.create(i, i);
+				}
+				for(int i : order){
+					sink = objects[i]->position.x;
+					if(kind == 0) delete objects[i];
+					else if(kind == 1) pool.destroy(objects[i]);
+					else cache.destroy(objects[i]);
+				}
+			}, live);
+			print(r);
+		}
+	}
+}
+
+int main(int argc, char ** argv){
+	for(int i = 1; i < argc; i++){
+		if(!strcmp(argv[i], "--kernel") && i + 1 < argc) kernel_filter = argv[++i];
+		else if(!strcmp(argv[i], "--threads") && i + 1 < argc) threads = atoi(argv[++i]);
+		else{
+			fprintf(stderr, "usage: %s [--threads n] [--kernel h_intercept|v_intercept|dda|packet|wall_slice|floor_rows|"
+							"ceiling_rows|sprite_draw|render_sprites|sprite_order|pvs_build|map_load|transpose|pool]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	rc::load_bench_textures();
+
+	print_header();
+	bench_traversal();
+	bench_slices();
+	bench_sprite_draw();
+	bench_render_sprites();
+	bench_sprite_order();
+	bench_pvs_build();
+	bench_map_load();
+	bench_transpose();
+	bench_pool();
+
+	return 0;
+}
@@ -0,0 +1,208 @@
+/*
+ * Headless end to end benchmark for rc::Core::render().
+ *
+ * Replays a fixed camera path through every bench map at several projection plane
+ * resolutions, no window, no vsync and no cap_fps(), so the numbers are the renderer's alone.
+ *
+ * usage: bench_render [--frames n] [--warmup n] [--res WxH,WxH,...] [--map name] [--threads n,n,...]
+ *                     [--flags textured,dda,...] [--isa scalar|sse|avx2] [--in-place] [--hold n] [--spin n]
+ *
+ * --hold n keeps every camera position of the path for n frames, a player that keeps stopping,
+ * which is what the layers flag, LAYERED_SCENE, is for. It gives the checksums of the same run without it.
+ *
+ * --spin n stands at the start of the path and turns n columns a frame instead, the motion the
+ * reproject flag, REPROJECT_ROTATION, reuses rays for.
+ *
+ * --in-place renders row major frames straight into the present buffer with set_frame_target(),
+ * the way the engine renders into a locked texture, instead of copying them out. Its rows are
+ * padded to IN_PLACE_PITCH_PAD more bytes, a texture's pitch is not always its width.
+ * */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "bench.h"
+
+#define PVS_BENCH_MAX_CELLS (256 * 256)
+#define IN_PLACE_PITCH_PAD 64
+
+struct Resolution{ int w, h; };
+
+static std::vector<std::string> split(const char * arg){
+	std::vector<std::string> parts;
+	std::string s(arg);
+	size_t start = 0;
+
+	while(start < s.size()){
+		size_t end = s.find(',', start);
+		if(end == std::string::npos) end = s.size();
+
+		parts.push_back(s.substr(start, end - start));
+		start = end + 1;
+	}
+
+	return parts;
+}
+
+static std::vector<Resolution> parse_resolutions(const char * arg){
+	std::vector<Resolution> res;
+	for(const auto& part : split(arg)){
+		Resolution r;
+		RC_DIE(sscanf(part.c_str(), "%dx%d", &r.w, &r.h) != 2, "bad --res");
+		res.push_back(r);
+	}
+	return res;
+}
+
+static std::vector<int> parse_list(const char * arg){
+	std::vector<int> values;
+	for(const auto& part : split(arg)){
+		values.push_back(atoi(part.c_str()));
+	}
+	return values;
+}
+
+static void camera_at(const rc::Bench_map& map, double t, rc::Vec2f& pos, double& angle){
+	size_t segments = map.path.size() - 1;
+	double s = t * segments;
+	size_t i = std::min(static_cast<size_t>(s), segments - 1);
+	double f = s - i;
+
+	const auto& a = map.path[i];
+	const auto& b = map.path[i + 1];
+
+	pos = rc::Vec2f(a.x + (b.x - a.x) * f, a.y + (b.y - a.y) * f);
+	angle = a.angle + (b.angle - a.angle) * f;
+}
+
+int main(int argc, char ** argv){
+	int frames = 300;
+	int warmup = 30;
+	const char * map_filter = NULL;
+	std::vector<int> thread_counts = {0};
+	uint32_t flags = rc::DRAW_TEXT_MAPPED_WALLS;
+	rc::Packet_isa isa = rc::best_packet_isa();
+	bool in_place = false;
+	int hold = 1;
+	int spin = 0;
+	std::vector<Resolution> resolutions = {{320, 200}, {640, 480}, {800, 600}, {1280, 720}, {1920, 1080}};
+
+	for(int i = 1; i < argc; i++){
+		if(!strcmp(argv[i], "--frames") && i + 1 < argc) frames = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--warmup") && i + 1 < argc) warmup = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--res") && i + 1 < argc) resolutions = parse_resolutions(argv[++i]);
+		else if(!strcmp(argv[i], "--map") && i + 1 < argc) map_filter = argv[++i];
+		else if(!strcmp(argv[i], "--threads") && i + 1 < argc) thread_counts = parse_list(argv[++i]);
+		else if(!strcmp(argv[i], "--flags") && i + 1 < argc) flags = rc::parse_render_flags(argv[++i]);
+		else if(!strcmp(argv[i], "--isa") && i + 1 < argc) isa = rc::parse_packet_isa(argv[++i]);
+		else if(!strcmp(argv[i], "--in-place")) in_place = true;
+		else if(!strcmp(argv[i], "--hold") && i + 1 < argc) hold = std::max(1, atoi(argv[++i]));
+		else if(!strcmp(argv[i], "--spin") && i + 1 < argc) spin = atoi(argv[++i]);
+		else{
+			fprintf(stderr, "usage: %s [--frames n] [--warmup n] [--res WxH,...] [--map name] [--threads n,...] "
+							"[--flags name,...] [--isa name] [--in-place] [--hold n] [--spin n]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	RC_DIE(frames < 2, "--frames must be at least 2");
+
+	rc::load_bench_textures();
+
+	printf("flags: %s", rc::render_flag_names(flags).c_str());
+	if(flags & rc::TRAVERSAL_PACKET){
+		printf(" isa: %s", rc::packet_isa_name(std::min(isa, rc::best_packet_isa())));
+	}
+	if(in_place && !(flags & rc::TARGET_COLUMN_MAJOR)){
+		printf(" in place");
+	}
+	printf("\n");
+	printf("%-12s %-10s %4s %7s %9s %8s %8s %8s %7s %8s %9s  %-16s\n",
+		   "map", "res", "thr", "frames", "fps", "p50 ms", "p99 ms", "ns/px", "scale", "speedup", "arena KiB", "checksum");
+
+	for(const auto& map : rc::bench_maps()){
+		if(map_filter && map.name != map_filter) continue;
+
+		// scale is the cost per pixel relative to the first resolution, 1.0 is linear.
+		// speedup is relative to the first thread count at the same resolution.
+		std::vector<double> base_ns_per_px(thread_counts.size(), 0.0);
+
+		// built once per map, like a map file would bring it. Past PVS_BENCH_MAX_CELLS it's left
+		// out and the pvs flag does nothing, the build is minutes on a map as open as hall_1024.
+		std::shared_ptr<const rc::Pvs> pvs;
+		if((flags & rc::VISIBILITY_PVS) && map.w * map.h <= PVS_BENCH_MAX_CELLS){
+			rc::Workers workers(std::thread::hardware_concurrency());
+			pvs = std::make_shared<rc::Pvs>(rc::build_pvs(rc::Map(&map.values[0], map.w, map.h), workers));
+		}
+
+		for(const auto& res : resolutions){
+			double base_mean_ms = 0.0;
+
+			for(size_t t = 0; t < thread_counts.size(); t++){
+				rc::Core_bench core(res.w, res.h, thread_counts[t]);
+				core.set_packet_isa(isa);
+				core.set_map(map.values, map.w, map.h);
+				core.set_sprites(map.sprites);
+				core.set_pvs(pvs);
+
+				std::vector<uint32_t> frame(res.w * res.h);
+				int pitch = res.w * sizeof(uint32_t) + IN_PLACE_PITCH_PAD;
+				std::vector<uint32_t> target(pitch / sizeof(uint32_t) * res.h);
+				if(in_place) core.set_frame_target(0, &target[0], pitch);
+				std::vector<double> times;
+				times.reserve(frames);
+				uint64_t hash = 0;
+
+				for(int f = -warmup; f < frames; f++){
+					rc::Vec2f pos;
+					double angle;
+					int step = std::max(f, 0) / hold * hold;
+					if(spin){
+						camera_at(map, 0.0, pos, angle);
+						angle += step * spin * (static_cast<double>(FOV) / res.w);
+					}else{
+						camera_at(map, static_cast<double>(step) / (frames - 1), pos, angle);
+					}
+
+					core.set_camera(pos, angle);
+
+					// a frame is done once it's row major in the present buffer, the way the engine hands it to SDL.
+					auto start = std::chrono::steady_clock::now();
+					const uint32_t * pixels = core.render(flags);
+					if(pixels != &target[0]) core.copy_frame(&frame[0], res.w * sizeof(uint32_t));
+					double ms = rc::elapsed_ms(start);
+
+					// packed again for the checksum, out of the timing.
+					if(pixels == &target[0]){
+						for(int y = 0; y < res.h; y++){
+							memcpy(&frame[y * res.w], pixels + y * (pitch / sizeof(uint32_t)), res.w * sizeof(uint32_t));
+						}
+					}
+
+					if(f >= 0){
+						times.push_back(ms);
+						hash = hash * 31 + rc::checksum(&frame[0], res.w * res.h);
+					}
+				}
+
+				rc::Frame_stats stats(std::move(times));
+				double mean_ms = stats.total / frames;
+				double ns_per_px = (mean_ms * 1e6) / (res.w * res.h);
+
+				if(base_ns_per_px[t] == 0.0) base_ns_per_px[t] = ns_per_px;
+				if(base_mean_ms == 0.0) base_mean_ms = mean_ms;
+
+				char res_str[32];
+				snprintf(res_str, sizeof(res_str), "%dx%d", res.w, res.h);
+
+				printf("%-12s %-10s %4zu %7d %9.1f %8.3f %8.3f %8.2f %7.2f %8.2f %9.1f  %016llx\n",
+					   map.name.c_str(), res_str, core.threads(), frames, 1000.0 / mean_ms,
+					   stats.percentile(0.50), stats.percentile(0.99),
+					   ns_per_px, ns_per_px / base_ns_per_px[t], base_mean_ms / mean_ms,
+					   core.arena_high_water() / 1024.0, static_cast<unsigned long long>(hash));
+			}
+		}
+	}
+
+	return 0;
+}
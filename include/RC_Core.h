@@ -7,46 +7,147 @@
 #include <SDL2/SDL.h>
 
 #include "map.h"
+#include "map_file.h"
+#include "pvs.h"
 #include "player.h"
 #include "utils.h"
 #include "Resources.h"
 #include "Sprite.h"
+#include "Workers.h"
+#include "ray_packet.h"
+#include "profiler.h"
+#include "arena.h"
+
+#define COLUMNS_PER_JOB 16 // screen columns handed to a worker at a time.
+#define ROWS_PER_JOB 8 // floor and ceiling rows handed to a worker at a time.
+#define MAX_FRAME_BUFFERS 3 // one being presented and up to two rendered ahead of it.
+#define REPROJECT_TOLERANCE 1e-3 // in columns, how far off a whole column turn a reused ray may be.
+#define REPROJECT_EDGE 1e-6      // world units, or degrees, from an edge where a reused ray is traced again.
+#define PVS_SPRITE_PAD 1e-3      // world units the cells a sprite's columns reach are looked for past, for rounding.
+#define SPRITE_CULL_PAD 1e-3     // world units the cells under the view are looked for past, for rounding.
 
 
 namespace rc{
 	enum RenderFlag{
 		DRAW_RAW_WALLS = 0x1,
 		DRAW_TEXT_MAPPED_WALLS = 0x2,
+		TRAVERSAL_DDA = 0x4, // one grid walk per column along precomputed directions, no tan() per ray.
+		TRAVERSAL_PACKET = 0x8, // the same walk for packet_width() adjacent columns at once, see ray_packet.h.
+		TARGET_COLUMN_MAJOR = 0x10, // render into a column major framebuffer, copy_frame() transposes it.
+		TEXTURE_MIPMAPS = 0x20, // sample walls, floor, ceiling and sprites from the mip level their size on screen calls for.
+		VISIBILITY_PVS = 0x40, // cull sprites by the map's pvs for the player's cell, if it has one.
+		LAYERED_SCENE = 0x80, // keep the walls, floor and ceiling a still camera sees and only redraw the sprites.
+		REPROJECT_ROTATION = 0x100, // a camera that only turned reuses the last frame's rays for the columns it still sees.
 	};
 
 	struct Resources;
+	struct Core_bench;
 
 	struct Core{
-		friend Sprite;
+		friend Core_bench;
 
 		Core(size_t proj_plane_w, size_t proj_plane_h, double fov);
 		~Core();
-		void render_sprites();
-		const uint32_t * render(uint32_t flags);
+		void render_sprites(uint32_t flags);
+		/* Renders into framebuffer buffer of frame_buffers() and returns it, row major unless flags
+		 * has TARGET_COLUMN_MAJOR, into its target with the target's pitch if it has one.
+		 * copy_frame() always gives that buffer's frame row major and packed to dst's pitch. Only
+		 * the framebuffer is per buffer, one frame is rendered at a time, but while it is another
+		 * buffer's frame can be copied out on a different thread.*/
+		const uint32_t * render(uint32_t flags, int buffer = 0);
+		void copy_frame(uint32_t * dst, int pitch, int buffer = 0) const;
+		/* Has render() draw buffer's row major frames straight into pixels, pitch bytes from one
+		 * row to the next, e.g. a locked streaming texture. NULL goes back to the buffer's own
+		 * memory. pixels has to stay valid until the frame is rendered and copied out.*/
+		void set_frame_target(int buffer, uint32_t * pixels, int pitch);
+		/* Maps the DRAW_RAW_WALLS colors, given as RGBA8888, to format. It has to match the
+		 * textures in m_resources, the framebuffer holds whatever 32 bit format those are in.*/
+		void set_pixel_format(uint32_t format);
+		void set_frame_buffers(int count);
+		int frame_buffers() const { return static_cast<int>(m_fbuffers.size()); };
+		/* Grows whenever the map or the sprites change, a frame with the same camera, flags and
+		 * scene_version() as another is the same image.*/
+		uint64_t scene_version() const { return m_map_version + m_sprite_version; };
+		/* The plane can be resized between frames, render() then draws at the new size.*/
+		void set_plane_size(int w, int h);
+		constexpr int plane_w() const { return m_proj_plane_w; };
+		constexpr int plane_h() const { return m_proj_plane_h; };
+		void set_threads(size_t count);
+		size_t threads() const { return m_workers->count(); };
+		void set_packet_isa(Packet_isa isa);
+		constexpr Packet_isa packet_isa() const { return m_packet_isa; };
 		constexpr const std::vector<Vec2f>& hits() const { return m_hits; };
-		constexpr const std::vector<Sprite>& get_sprites() const { return m_sprites; };
+		constexpr const Sprites& get_sprites() const { return m_sprites; };
+		// most of m_arena a frame has used, in bytes.
+		constexpr size_t arena_high_water() const { return m_arena.high_water(); };
+#ifdef RC_PROFILE
+		// stage times of the frame last rendered into buffer, summed over the workers.
+		const Profile_times& frame_profile(int buffer) const { return m_fbuffers[buffer].profile; };
+#endif
 
 
 		private:
-			double find_h_intercept(double ray_angle, Vec2f& h_hit, Vec2i& map_coords);
-			double find_v_intercept(double ray_angle, Vec2f& v_hit, Vec2i& map_coords);
+			struct Ray_hit{
+				Vec2f point;
+				Vec2i cell;      // INT_MAX, INT_MAX when the ray left the map.
+				double dist;     // fisheye corrected, DBL_MAX on a miss.
+				int texture_x;
+			};
+
+			double find_h_intercept(double ray_angle, Vec2f& h_hit, Vec2i& map_coords, int worker);
+			double find_v_intercept(double ray_angle, Vec2f& v_hit, Vec2i& map_coords, int worker);
+			Ray_hit cast_ray_dda(const Vec2f& dir, double cos_offset, int worker);
+			Ray_hit cast_ray(int x, uint32_t flags, int worker);
+			void cast_ray_packet(int x, int count, Ray_hit * hits, int worker);
+			void cast_rays(int x0, int x1, uint32_t flags, Ray_hit * hits, int worker);
+
+			void compute_ray_tables();
+			void compute_view();
+			void render_column(int x, const Ray_hit& hit, uint32_t flags);
+			void render_scene(uint32_t flags);
+			int reproject_turn(uint32_t flags) const;
+			bool reproject_ray(int x, uint32_t flags, const Ray_hit& last, Ray_hit& hit) const;
 
-			void draw_textmapped_wall_slice(int texture_x, int slice_height, int screen_x, SDL_Surface * texture);
+			void cache_layer();
+			void compose_layer(uint32_t flags);
+			void restore_rect(const SDL_Rect& rect);
+			void keep_sprite_rects();
+
+			void draw_textmapped_wall_slice(int texture_x, int slice_height, int screen_x, const Texture& texture, bool mipmapped);
 
 			void draw_wall_slice(int y_top, int y_bot, int x, uint32_t color);
 
-			void draw_floor_slice(double ray_angle, int screen_x, int wall_bottom_y);
+			void set_floor_column(int x, int wall_top, int wall_bot);
+
+			void draw_floor_row(int y, uint32_t flags);
 
-			void draw_celing_slice(double ray_angle, int screen_x, int wall_top);
+			void draw_ceiling_row(int y, uint32_t flags);
+
+			void draw_floor_ceiling_rows(int y0, int y1, uint32_t flags);
+
+			void draw_floor_column(int x, uint32_t flags);
+
+			void draw_ceiling_column(int x, uint32_t flags);
+
+			struct Floor_column;
+			bool floor_texel(const Floor_column& column, double straight_dist_to_P, int texture_shift, int level, uint32_t& color) const;
 
 			SDL_Rect sprite_screen_dimensions(int screen_x, double dist_to_sprite);
 
-			Vec2i sprite_world_2_screen(const Sprite& sprite);
+			Vec2i sprite_world_2_screen(const Vec2f& position);
+
+			void draw_sprite(int texture_id, const SDL_Rect& dim, double dist_from_player, int clip_x0, int clip_x1, bool mipmapped);
+
+			void find_pvs_set(uint32_t flags);
+			void cull_sprites();
+			bool pvs_sees_sprite(uint32_t index);
+			void find_sprite_cells();
+
+			void clear_visited();
+			void cover_visited(int worker, int x, int y);
+			inline void mark_visited(int worker, int x, int y){ m_visited[worker].cells[m_map->index(x, y)] = 1; };
+
+			uint32_t map_color(uint32_t rgba) const;
 
 			double perpendicular_distance(double viewing_angle, const Vec2f& p, const Vec2f& hit);
 
@@ -55,10 +156,21 @@ namespace rc{
 
 
 		protected:
+			/* Buckets m_sprites by map cell, call it whenever the sprites or the map change.*/
+			void index_sprites();
+			/* Replaces the map, the sprites and the player's position with the ones in file.*/
+			void load_map(const Map_file& file);
+			/* Sizes the visited grids to the map, call it whenever the map changes.*/
+			void reset_visited();
+			/* For changes the two above don't see, the next frame doesn't reuse what was drawn
+			 * before it, see LAYERED_SCENE.*/
+			void map_changed() { m_map_version++; };
+			void sprites_changed() { m_sprite_version++; };
+
 			rc::Resources * m_resources;
 			std::unique_ptr<Player> m_player;
 			std::unique_ptr<Map> m_map;
-			std::vector<Sprite> m_sprites;
+			Sprites m_sprites;
 
 		private:
 			int m_proj_plane_w;
@@ -67,31 +179,183 @@ namespace rc{
 			double m_angle_step;
 			std::vector<Vec2f> m_hits;
 			std::vector<double> m_wall_dists;
+			std::vector<double> m_ray_angles;
+
+			/* What the floor and ceiling rows need from each column, filled in by render_column().*/
+			struct Floor_column{
+				Vec2f ray_dir;
+				double cosine_beta; // cosine of the angle between the ray and the viewing direction.
+				int wall_top;       // ceiling is drawn on rows <= wall_top.
+				int wall_bot;       // floor is drawn on rows >= wall_bot.
+			};
+			std::vector<Floor_column> m_floor_columns;
+			std::vector<double> m_row_dists; // straight distance to the floor or ceiling seen on each row.
+			std::vector<int> m_row_levels;   // mip level of the floor or ceiling texels on each row.
+
+			/* (cos, sin) of every column's angle from the viewing direction. Only depends on the fov
+			 * and the plane width, so it is built once by compute_ray_tables().*/
+			std::vector<Vec2f> m_column_dirs;
+			Vec2f m_forward; // unit viewing direction for this frame.
+			Vec2f m_left;    // forward rotated 90 degrees counter clockwise.
+
+			// format of the DRAW_RAW_WALLS colors, NULL leaves them RGBA8888.
+			SDL_PixelFormat * m_pixel_format;
+
+			uint64_t m_map_version;
+			uint64_t m_sprite_version;
+
+			/*
+			 * Under LAYERED_SCENE, the walls, floor and ceiling of the last camera that stood still
+			 * for two frames in a row, and the depth and hits the sprites are culled and tested
+			 * against. A frame with the same key only redraws the sprites over it. It is taken
+			 * from the second frame, a moving camera never pays for it.
+			 * */
+			struct Layer_key{
+				Vec2f position;
+				double viewing_angle;
+				uint64_t map_version;
+				uint32_t flags;
+
+				bool operator==(const Layer_key& other) const {
+					return position.x == other.position.x && position.y == other.position.y &&
+						   viewing_angle == other.viewing_angle && map_version == other.map_version && flags == other.flags;
+				};
+			};
+			struct{
+				Layer_key key;
+				uint64_t serial; // 0 while there's none.
+				std::vector<uint32_t> pixels; // packed, in the layout key.flags renders.
+				std::vector<double> wall_dists;
+				std::vector<Vec2f> hits;
+			}m_layer;
+			uint64_t m_layer_serial;
+			Layer_key m_last_key; // of the last frame rendered.
+
+			/* Every column's ray of the last frame traced under REPROJECT_ROTATION, hits[last], and
+			 * where it was traced from. The frame being traced writes the other one.*/
+			struct{
+				std::vector<Ray_hit> hits[2];
+				int last;
+				Vec2f position;
+				double viewing_angle;
+				uint64_t map_version;
+				bool valid;
+			}m_rays;
+
+			// what the player's cell sees this frame under VISIBILITY_PVS, NULL without it.
+			const Pvs_set * m_pvs_set;
+
+			std::unique_ptr<Workers> m_workers;
+			Packet_isa m_packet_isa;
+#ifdef RC_PROFILE
+			std::vector<Profile_times> m_profile; // per worker, summed into the framebuffer's at the end of render().
+#endif
+
+			/* Cells the rays walked through this frame, a byte per cell in Map::index() order and one
+			 * grid per worker so columns can be traced in parallel without sharing writes. Every walk is a
+			 * straight line from the player, so the cells it marks are inside the rect between the
+			 * player's cell and the one it stopped on, [x0, x1] x [y0, y1] is the union of those.
+			 * The next frame clears the chunks under it instead of the whole map. The grids are
+			 * calloc'd, on a big map they stay zero pages until the rays get to them. Rays reused by
+			 * REPROJECT_ROTATION aren't walked again and mark nothing.*/
+			struct Free_deleter{ void operator()(void * p) const { free(p); }; };
+			struct Visited_cells{
+				std::unique_ptr<uint8_t[], Free_deleter> cells;
+				int x0, y0, x1, y1;
+			};
+			std::vector<Visited_cells> m_visited;
+
+			struct Projected_sprite{
+				int texture_id;
+				SDL_Rect dim;
+				double dist;
+			};
+			Arena_vector<Projected_sprite> m_projected_sprites;
+
+			/* m_sprites bucketed by the cell they stand on, the sprites of cell i are
+			 * sprites[cell_start[i]] up to sprites[cell_start[i + 1]]. Built by bucket_sprites(),
+			 * or read straight from a map file, storage keeps either alive.*/
+			struct{
+				const uint32_t * cell_start;
+				const uint32_t * sprites;
+				size_t count;
+				std::shared_ptr<const void> storage;
+			}m_sprite_grid;
+			Arena_vector<uint32_t> m_sprite_candidates; // the sprites in the cells under the view that pass the fov tests.
+
+			struct Visible_sprite{
+				uint32_t index;
+				double dist;
+			};
+			Arena_vector<Visible_sprite> m_visible_sprites; // at most MAX_SPRITES, back to front.
+
+			/* What's built and thrown away every frame, the sprite lists above, is allocated from
+			 * m_arena and dropped all at once by reset_arena() at the top of render().*/
+			Arena m_arena;
+			void reset_arena();
 
 			/*These are values that are used repeatedly throughout Core for other calculations.
 			 *However they can be known at start up, so they are computed once and kept in this
 			 struct for access.*/
 			struct{
 				double half_fov;
-				int columns_per_angle;  // constant value used in sprite_world_2_screen conversion.
+				double columns_per_angle;  // constant value used in sprite_world_2_screen conversion, only the screen x is truncated.
 				double cell_size_times_dist; // constant value used to calculate a wall slice height.
 				double pheight_times_distplane;  /* Used to figure out the straight distance to a point P at the ceiling or floor.*/
 			}m_constants;
 
 			struct Frame_buffer{
 				Frame_buffer() {};
-				Frame_buffer(int w, int h) : w(w), h(h) { pixels.resize(w * h, 0); };
-				inline void clear() { std::fill(pixels.begin(), pixels.end(), 0); };
+				Frame_buffer(int w, int h) : w(w), h(h), target(NULL), target_pitch(0), layer(0), sprites(0) { storage.resize(w * h, 0); set_layout(false); };
+				inline void resize(int new_w, int new_h) {
+					w = new_w;
+					h = new_h;
+					storage.assign(w * h, 0);
+					layer = 0;
+					sprite_rects.clear();
+				};
+				inline void clear() {
+					if(y_stride == w || column_major){
+						std::fill(pixels, pixels + w * h, 0);
+						return;
+					}
+					for(int y = 0; y < h; y++){
+						std::fill(pixels + y * y_stride, pixels + y * y_stride + w, 0);
+					}
+				};
+				// a column major frame is transposed by copy_frame() anyway, it stays in storage.
+				inline void set_layout(bool col_major) {
+					column_major = col_major;
+					pixels = target && !column_major ? target : storage.data();
+					x_stride = column_major ? h : 1;
+					y_stride = column_major ? 1 : (pixels == target ? target_pitch : w);
+				};
 				inline void set_pixel(int x, int y, uint32_t color) { 
 					if(y < h && x < w && x >= 0 && y >= 0){
-						pixels[y * w + x] = color; 
+						pixels[x * x_stride + y * y_stride] = color; 
 					}
 				};
 				public:
-					std::vector<uint32_t> pixels;
+					std::vector<uint32_t> storage;
+					uint32_t * pixels; // storage, or target for a row major frame.
 					int w;
 					int h;
-			}m_fbuffer;
+					bool column_major;
+					int x_stride; // distance between horizontally adjacent pixels.
+					int y_stride; // and between vertically adjacent ones.
+					uint32_t * target; // see set_frame_target(), NULL for storage.
+					int target_pitch;  // in pixels.
+
+					// m_layer.serial of the scene under the sprites, 0 if it isn't that one.
+					uint64_t layer;
+					uint64_t sprites; // m_sprite_version they were drawn for.
+					std::vector<SDL_Rect> sprite_rects;
+#ifdef RC_PROFILE
+					Profile_times profile;
+#endif
+			};
+			std::vector<Frame_buffer> m_fbuffers;
+			Frame_buffer * m_fbuffer; // the one render() is drawing into.
 
 
 	};
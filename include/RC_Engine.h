@@ -2,16 +2,30 @@
 
 #include <unordered_map>
 #include <string>
+#include <thread>
 
 #include "utils.h"
 #include "player.h"
 #include "RC_Core.h"
+#include "frame_ring.h"
+#include "profiler.h"
 
 #define KEYBOARD_MAX_KEYS 350
 
 #define PROJ_PLANE_W 800
 #define PROJ_PLANE_H 600
 
+#define PLANE_SCALE_MIN 0.5       // of PROJ_PLANE_W and PROJ_PLANE_H, the lowest resolution the controller goes to.
+#define PLANE_SCALE_STEP 0.05     // most the scale moves in a frame.
+#define PLANE_SCALE_HEADROOM 0.85 // the scale only grows back while frames take less than this much of the target.
+#define PLANE_ALIGN 8             // plane widths are a multiple of this, a new size is a new texture.
+#define RENDER_TIME_WEIGHT 0.1    // of the newest frame in the average render time.
+
+#define TARGET_FPS 60
+#define SIM_HZ 120       // fixed steps of the game a second, whatever the frame rate.
+#define MAX_SIM_STEPS 8  // a stall longer than this many steps drops the rest instead of catching up.
+#define SPIN_MS 1.5      // the end of a wait is spun, SDL_Delay() can oversleep by a ms or so.
+
 namespace rc{
 	enum TextureID{
 		FLOOR_TEXT,
@@ -40,12 +54,25 @@ namespace rc{
 			void do_keydown(const SDL_KeyboardEvent * e);
 			void do_input();
 			void prepare_scene();
-			void cap_fps();
+			void wait_frame(bool precise);
+			void step_simulation();
+			void interpolate_view();
 			void update();
-			void draw();
+			void draw(int buffer);
+
+			bool frame_changed() const;
+			void submit_frame();
+			void render_frame(int buffer);
+			void render_loop();
+			void present_frame();
 
 			void load_textures();
 			void init_viewports();
+			void create_frame_texture(int buffer, int w, int h);
+			void scale_resolution(double render_ms);
+#ifdef RC_PROFILE
+			void draw_profile();
+#endif
 
 		
 			SDL_Window * m_window;
@@ -53,8 +80,76 @@ namespace rc{
 			bool m_running;
 			std::unordered_map<std::string, SDL_Rect> m_viewports;
 
-			SDL_Texture * m_fbuffer_texture;
+			/* A streaming texture per framebuffer of Core, in the renderer's native format. With
+			 * m_zero_copy a row major frame is rendered straight into its texture: the main thread
+			 * locks it when the frame is submitted and unlocks it to present it, the render thread
+			 * only ever writes to the memory in between.*/
+			SDL_Texture * m_frame_textures[MAX_FRAME_BUFFERS];
+			uint32_t m_texture_format; // SDL_PixelFormatEnum of the frame textures and of the surfaces loaded for them.
+			bool m_zero_copy;
 			Map map;
+			uint32_t m_render_flags;
+
+			/*
+			 * Frames are rendered on m_render_thread while the main thread presents the ones before
+			 * them, at most m_frame_queue ahead, each in its own framebuffer of Core. The game moves
+			 * m_sim_player, every frame takes a copy of its camera along, Core's m_player is the
+			 * camera of the frame being rendered and only the render thread touches it.
+			 * */
+			struct Frame{
+				Vec2f position;
+				double viewing_angle;
+				int w; // plane size it's rendered at, and the size of its texture.
+				int h;
+				const uint32_t * pixels;
+				uint32_t * target; // the locked texture under m_zero_copy, NULL otherwise.
+				int pitch;
+				double render_ms;
+#ifdef RC_PROFILE
+				Profile_times profile; // Core's stages, and the main thread's since the frame before.
+#endif
+			};
+			Player m_sim_player;
+			/* m_sim_player before its last step. Frames show the camera m_view_position and
+			 * m_view_angle, interpolate_view() puts it between the two by how far time is into
+			 * the next step.*/
+			Player m_prev_player;
+			Vec2f m_view_position;
+			double m_view_angle;
+			Frame m_frames[MAX_FRAME_BUFFERS];
+			std::vector<int> m_free_buffers; // main thread only.
+			Frame_ring m_to_render;          // main thread to render thread, -1 stops it.
+			Frame_ring m_to_present;         // and back.
+			int m_frame_queue;
+			std::thread m_render_thread;
+
+			// what the last frame submitted showed, under LAYERED_SCENE an idle game submits none.
+			Frame m_last_frame;
+			uint64_t m_last_scene;
+			bool m_redraw; // the window needs a frame whatever the last one was.
+
+			/*
+			 * Internal resolution. Frames are rendered at w x h, somewhere between PLANE_SCALE_MIN
+			 * and all of PROJ_PLANE_W x PROJ_PLANE_H, and SDL_RenderCopy stretches them over the
+			 * window. scale_resolution() moves the scale after every frame presented to keep the
+			 * average render time at target_ms.
+			 * */
+			struct{
+				double target_ms; // 0 renders every frame at the full size.
+				double average_ms;
+				double scale;
+				int w;
+				int h;
+			}m_resolution;
+
+#ifdef RC_PROFILE
+			/* Every frame's stages go to m_profiler when it's presented. Input and update run on
+			 * every turn of the loop whether a frame is submitted or not, m_profile gathers them
+			 * until one is.*/
+			Profiler m_profiler;
+			Profile_times m_profile;
+			bool m_profile_overlay;
+#endif
 
 		public:
 			int screen_w;
@@ -63,9 +158,20 @@ namespace rc{
 			struct{
 				uint64_t prev_time;
 				uint64_t frequency;
-				double delta_time;
+				double delta_time; // of a simulation step, 1 / SIM_HZ.
+				uint64_t deadline; // counter value the next frame starts at.
+				double accumulator; // seconds not simulated yet, less than a step after step_simulation().
 			}time;
 
+			/* Frame pacing: frames the loop started, how many deadlines went by without one,
+			 * and how late it woke up after a deadline, worst and in total.*/
+			struct{
+				uint64_t frames;
+				uint64_t missed;
+				double max_late_ms;
+				double total_late_ms;
+			}pacing;
+
 			struct{
 				uint32_t keyboard[KEYBOARD_MAX_KEYS];
 			}input;
@@ -76,6 +182,7 @@ namespace rc{
 	bool box_collision(const SDL_Rect * r1, const SDL_Rect * r2);
 	SDL_Texture * load_texture(Engine * r2d, const char * filename);
 	SDL_Texture * load_texture(Engine * r2d, const char * filename, uint32_t colorkey);
-	SDL_Surface * load_surface_RGBA(SDL_Renderer * renderer, const std::string& filename);
-	SDL_Surface * load_surface_RGBA(SDL_Renderer * renderer, const std::string& filename, uint32_t colorkey);
+	uint32_t native_pixel_format(SDL_Renderer * renderer);
+	SDL_Surface * load_surface(const std::string& filename, uint32_t format);
+	SDL_Surface * load_surface(const std::string& filename, uint32_t format, uint32_t colorkey);
 }
@@ -2,26 +2,91 @@
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
+#include <algorithm>
 #include <unordered_map>
+#include <vector>
+
+#define TEXTURE_ALIGN 16 // pixels, every texture in the atlas starts on a 64 byte boundary.
+#define MIP_MAX_LEVELS 12
 
 namespace rc{
+	/* A run of opaque texels [start, end) down one texture column, copied out so the run is
+	 * contiguous: texel y of the run is span_texels[texels + y - start].*/
+	struct Texel_span{
+		uint16_t start;
+		uint16_t end;
+		uint32_t texels;
+	};
+
+	struct Mip_level{
+		const uint32_t * pixels = NULL;
+		int w = 0; // the level above halved and rounded up, so x >> level is always in range.
+		int h = 0;
+
+		/* Run length form for sprites, the color key never reaches the rasterizer. Column x
+		 * owns spans[column_spans[x]] up to spans[column_spans[x + 1]].*/
+		const uint32_t * column_spans = NULL;
+		const Texel_span * spans = NULL;
+		const uint32_t * span_texels = NULL;
+	};
+
+	/* What the samplers need from a texture, row y starts at pixels + y * w. The mip chain is
+	 * built with the atlas, box filtered down to 1x1, level 0 is the texture itself.*/
+	struct Texture{
+		const uint32_t * pixels = NULL;
+		int w = 0;
+		int h = 0;
+		bool keyed = false; // pixels equal to key are transparent.
+		uint32_t key = 0;
+		int levels = 0;
+		Mip_level mips[MIP_MAX_LEVELS];
+
+		inline const Mip_level& level(int l) const { return mips[std::min(l, levels - 1)]; };
+
+		/* Smallest level that still has at least one texel per pixel when texels are drawn over
+		 * pixels on screen.*/
+		inline int level_for(int texels, int pixels) const {
+			int l = 0;
+			while(l + 1 < levels && (texels >> (l + 1)) >= pixels) l++;
+			return l;
+		};
+	};
+
 	struct Resources{
 		static Resources * instance(){
 			static Resources r;
 			return &r;
 		};
 
-		SDL_Surface * get_surface(int id) { 
-			if(m_surfaces.find(id) == m_surfaces.end()){
-				return NULL;
-			}else{
-				return m_surfaces[id]; 
-			}
+		SDL_Surface * get_surface(int id) const { 
+			auto it = m_surfaces.find(id);
+			return it == m_surfaces.end() ? NULL : it->second;
 		};
 
-		void add_surface(int id, SDL_Surface * s) { m_surfaces[id] = s; }
+		/* Only marks the texture table stale, build_atlas() puts it together once after loading.*/
+		void add_surface(int id, SDL_Surface * s);
+
+		/* Builds the texture table, mip chains and texel spans from every surface added so far,
+		 * nothing if none was added since the last build. Core::render() calls it too, but
+		 * texture() only sees a surface after a build.*/
+		void build_atlas();
+
+		/* Read only, safe to call from the render workers once the atlas is built. NULL if
+		 * nothing was added under id.*/
+		inline const Texture * texture(int id) const {
+			if(id < 0 || id >= static_cast<int>(m_textures.size()) || m_textures[id].pixels == NULL) return NULL;
+			return &m_textures[id];
+		};
 
 		private:
 			std::unordered_map<int, SDL_Surface *> m_surfaces;
+			bool m_dirty = false; // a surface was added since the last build_atlas().
+			/* Dense table indexed by TextureID, the pixels of all of them copied into one
+			 * contiguous atlas so the render loops never go through a hash or an SDL_Surface.*/
+			std::vector<Texture> m_textures;
+			std::vector<uint32_t> m_atlas;
+			std::vector<uint32_t> m_column_spans;
+			std::vector<Texel_span> m_spans;
+			std::vector<uint32_t> m_span_texels;
 	};
 }
@@ -3,22 +3,49 @@
 #include <cstdint>
 #include <vector>
 #include "vec2.h"
-#include <SDL2/SDL.h>
+
+#define SPRITE_SORT_BUDGET 8 // moves per sprite the insertion sort makes before it leaves the rest to std::sort.
 
 namespace rc{
-	struct Core;
-	struct Sprite{
-		Sprite(const Vec2f& pos, int id, Core * core);
-		Sprite& operator= (const Sprite& other);
-		void draw(const SDL_Rect& dim, double dist_from_player) const;
-		void update();
+	enum SpriteFlag{
+		SPRITE_HIDDEN = 0x1, // kept in the level but never drawn.
+	};
+
+	/*
+	 * Every sprite of the level, a field per array and sprite i at index i of each. The
+	 * positions and distances are packed into arrays of their own, update_distances() works
+	 * two lanes at a time.
+	 *
+	 * order holds the indices of the sprites the caller selected, the ones a frame may draw,
+	 * nearest first. The camera only moves a little between frames, so last frame's order is
+	 * nearly this frame's too and sort_by_distance() fixes it up with an insertion sort, linear
+	 * in the selected sprites when few of them swap places.
+	 * */
+	struct Sprites{
+		void add(const Vec2f& position, int texture_id, uint32_t flags = 0);
+		void clear();
+		void reserve(size_t count);
+		inline size_t size() const { return x.size(); };
+		inline bool empty() const { return x.empty(); };
+		inline Vec2f position(size_t i) const { return Vec2f(x[i], y[i]); };
+
+		/* Makes order hold candidates. The ones it held already keep their places from the last
+		 * sort, the others go at the end.*/
+		void select(const uint32_t * candidates, size_t count);
+		/* dist of the sprites in order only.*/
+		void update_distances(const Vec2f& p);
+		void sort_by_distance();
 
 		public:
-			Vec2f position;
-			int texture_id;
-			Core * m_core;
-			double last_dist_to_player;
+			std::vector<double> x;
+			std::vector<double> y;
+			std::vector<double> dist; // from the position update_distances() was last given.
+			std::vector<int> texture_id;
+			std::vector<uint32_t> flags; // SpriteFlag bits.
+			std::vector<uint32_t> cell;  // y * w + x of the map cell it stands on, set by Core.
+			std::vector<uint32_t> order; // selected, nearest first by dist, ties by index, after sort_by_distance().
+			std::vector<uint32_t> mark;  // selection while select() is putting the sprite in order, selection + 1 after.
+			uint32_t selection = 0;
 	};
 }
 
-
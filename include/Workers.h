@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rc{
+	/* Persistent pool of worker threads. run() hands out jobs 0..jobs-1 to whichever
+	 * worker asks first and returns once all of them are done. The calling thread takes
+	 * part as worker 0, so a pool of count 1 has no threads and runs everything inline.*/
+	struct Workers{
+		Workers(size_t count);
+		~Workers();
+
+		void run(int jobs, const std::function<void(int job, int worker)>& job);
+		constexpr size_t count() const { return m_count; };
+
+		private:
+			void loop(int worker);
+			void work(int worker);
+
+			size_t m_count;
+			std::vector<std::thread> m_threads;
+
+			std::mutex m_mutex;
+			std::condition_variable m_start;
+			std::condition_variable m_done;
+			uint64_t m_generation;
+			size_t m_busy;
+			bool m_quit;
+
+			const std::function<void(int, int)> * m_job;
+			int m_jobs;
+			std::atomic<int> m_next;
+	};
+}
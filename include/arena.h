@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#define ARENA_MIN_CHUNK (64 * 1024) // bytes, the smallest chunk an arena asks the heap for.
+
+namespace rc{
+	/*
+	 * Bump allocator for data that only lives for a frame. alloc() moves an offset through one
+	 * chunk, nothing is freed on its own, reset() drops everything at once. A frame that needs
+	 * more than the chunk has gets more chunks from the heap, and the reset() after it replaces
+	 * them all with a single chunk the size of high_water(), so once the frames stop growing
+	 * nothing goes to the heap any more. Not thread safe, Core's arena is only used by the render
+	 * thread, between reset_arena() calls.
+	 * */
+	struct Arena{
+		Arena() : m_size(0), m_used(0), m_extra_size(0), m_extra_used(0), m_extra_full(0), m_high_water(0) {};
+		Arena(Arena&&) = default;
+
+		void * alloc(size_t size, size_t align);
+		void reset();
+		size_t used() const { return m_used + m_extra_full + m_extra_used; };
+		constexpr size_t high_water() const { return m_high_water; }; // most used() got before a reset().
+
+		private:
+			std::unique_ptr<uint8_t[]> m_chunk;
+			size_t m_size;
+			size_t m_used;
+			std::vector<std::unique_ptr<uint8_t[]>> m_extra; // chunks the frame outgrew m_chunk into.
+			size_t m_extra_size; // of m_extra.back().
+			size_t m_extra_used; // of m_extra.back().
+			size_t m_extra_full; // of the ones before it.
+			size_t m_high_water;
+	};
+
+	/* Lets standard containers allocate from an Arena. deallocate() does nothing, the memory
+	 * goes back with reset(), so a container must not be used past the reset() of its arena.*/
+	template<typename T>
+	struct Arena_allocator{
+		using value_type = T;
+		// a container assigned a new one of these allocates from the new arena from then on.
+		using propagate_on_container_copy_assignment = std::true_type;
+		using propagate_on_container_move_assignment = std::true_type;
+		using propagate_on_container_swap = std::true_type;
+
+		Arena_allocator() : arena(NULL) {}; // has to be given an arena before it allocates.
+		Arena_allocator(Arena& arena) : arena(&arena) {};
+		template<typename U>
+		Arena_allocator(const Arena_allocator<U>& other) : arena(other.arena) {};
+
+		T * allocate(size_t n) { return static_cast<T *>(arena->alloc(n * sizeof(T), alignof(T))); };
+		void deallocate(T *, size_t) {};
+
+		Arena * arena;
+	};
+
+	template<typename T, typename U>
+	inline bool operator==(const Arena_allocator<T>& a, const Arena_allocator<U>& b) { return a.arena == b.arena; }
+	template<typename T, typename U>
+	inline bool operator!=(const Arena_allocator<T>& a, const Arena_allocator<U>& b) { return a.arena != b.arena; }
+
+	template<typename T>
+	using Arena_vector = std::vector<T, Arena_allocator<T>>;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+#define FRAME_RING_SIZE 4 // at least MAX_FRAME_BUFFERS, plus the stop message of the render thread.
+
+namespace rc{
+	/*
+	 * Single producer single consumer queue of framebuffer indices, the handoff between the
+	 * main thread and the render thread. Passing a buffer is a store to one of two atomic
+	 * counters, with no lock: the mutex is only taken by a consumer that found the ring empty
+	 * and goes to sleep in pop(), and by the push() that wakes it up. It holds every buffer
+	 * at once, so push() never waits.
+	 * */
+	struct Frame_ring{
+		Frame_ring() : m_head(0), m_tail(0), m_sleeping(false) {};
+
+		void push(int buffer);
+		bool try_pop(int& buffer);
+		int pop();
+
+		private:
+			int m_slots[FRAME_RING_SIZE];
+			std::atomic<uint32_t> m_head; // next slot push() writes, only stored by the producer.
+			std::atomic<uint32_t> m_tail; // next slot try_pop() reads, only stored by the consumer.
+			std::atomic<bool> m_sleeping;
+			std::mutex m_mutex;
+			std::condition_variable m_wake;
+	};
+}
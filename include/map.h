@@ -1,13 +1,18 @@
 #pragma once
 
 #include <cassert>
+#include <memory>
 #include <vector>
 #include "vec2.h"
 #include "utils.h"
 
 #include <SDL2/SDL.h>
 
-#define MAP_MAX_SIZE 64
+#define MAP_MAX_SIZE 4096
+#define MAP_CHUNK_SHIFT 4 // cells are stored in square chunks of 16 x 16, 1KB each.
+#define MAP_CHUNK_SIZE (1 << MAP_CHUNK_SHIFT)
+#define MAP_CHUNK_MASK (MAP_CHUNK_SIZE - 1)
+#define MAP_CHUNK_CELLS (MAP_CHUNK_SIZE * MAP_CHUNK_SIZE)
 #define CELL_SIZE 64 // cube of dimensions 64 x 64 x 64
 #define WALL_BIT 0x1
 #define FLOOR_CEIL_BIT 0x2
@@ -32,20 +37,45 @@
 
 namespace rc{
 	struct Engine;
-
+	struct Pvs;
+
+	/*
+	 * Cells are kept in square chunks, the chunks in row major order and the cells of a chunk
+	 * in row major order too. A ray or a neighbourhood lookup stays in one 1KB block for a while
+	 * instead of striding across whole map rows, which matters once maps are thousands of cells
+	 * wide. Chunks on the right and bottom edges are padded, the padding is never read.
+	 *
+	 * cells is read only and storage keeps it alive, copies of a Map share the same cells.
+	 * */
 	struct Map{
 		Map(){};
-		Map(const uint32_t * values, int w, int h);
+		Map(const uint32_t * values, int w, int h); // values in row major order, copied into chunks.
+		Map(const uint32_t * chunked, int w, int h, std::shared_ptr<const void> storage); // already in index() order, used in place.
 		void draw(rc::Engine * engine, size_t window_w, size_t window_h);
-		inline uint32_t at(int x, int y) const { return values[y * w + x]; };
+		inline size_t index(int x, int y) const {
+			size_t chunk = static_cast<size_t>(y >> MAP_CHUNK_SHIFT) * chunks_w + (x >> MAP_CHUNK_SHIFT);
+			return (chunk << (2 * MAP_CHUNK_SHIFT)) + ((y & MAP_CHUNK_MASK) << MAP_CHUNK_SHIFT) + (x & MAP_CHUNK_MASK);
+		};
+		inline uint32_t at(int x, int y) const { return cells[index(x, y)]; };
+		inline size_t cell_count() const { return static_cast<size_t>(chunks_w) * chunks_h * MAP_CHUNK_CELLS; };
+		std::vector<uint32_t> row_major() const;
 
 		public:
 			int w;
 			int h;
+			int chunks_w;
+			int chunks_h;
 			size_t cell_size;
-			std::vector<uint32_t> values;
+			const uint32_t * cells; // cell_count() values.
+			std::shared_ptr<const void> storage;
+			std::shared_ptr<const Pvs> pvs; // NULL unless one was built or loaded, see pvs.h.
 			const uint32_t * colors;
 	};
+
+	/* Sprite indices bucketed by the cell the sprite stands on, cells in row major order. The
+	 * result is w * h + 1 cell starts followed by count indices: the sprites of cell i are
+	 * indices[start[i]] up to indices[start[i + 1]]. Sprites off the map go in the nearest edge cell.*/
+	std::vector<uint32_t> bucket_sprites(const Map& map, const Vec2f * positions, size_t count);
 };
 
 
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "map.h"
+#include "vec2.h"
+
+#define MAP_FILE_MAGIC "RCMAP\0\0\0"
+#define MAP_FILE_VERSION 2
+#define MAP_FILE_ALIGN 4096 // every section starts on a page, so cell chunks never straddle one.
+
+namespace rc{
+	/*
+	 * On disk map, laid out the way the renderer reads it so a load is an mmap() and a few checks:
+	 *
+	 *   header                 Map_file_header, at offset 0.
+	 *   cells                  cell_count() uint32_t in Map::index() order, padding included.
+	 *   sprites                sprite_count Map_file_sprite.
+	 *   sprite grid            w * h + 1 + sprite_count uint32_t, bucket_sprites() of the sprites.
+	 *   textures               texture_count uint32_t, every TextureID the cells and sprites use.
+	 *   pvs                    optional, all three offsets are 0 without one: Pvs::cell_sets,
+	 *                          pvs_set_count Pvs_set and pvs_bit_words uint64_t, see pvs.h.
+	 *
+	 * Every offset is from the start of the file and a multiple of MAP_FILE_ALIGN. Values are
+	 * in the byte order of the machine that wrote the file, that's checked through byte_order.
+	 * A change to any of this bumps MAP_FILE_VERSION, old files are refused rather than guessed at.
+	 * */
+	struct Map_file_header{
+		char magic[8];
+		uint32_t version;
+		uint32_t byte_order; // 0x01020304 as written.
+		uint64_t file_size;
+		int32_t w;
+		int32_t h;
+		int32_t chunks_w;
+		int32_t chunks_h;
+		uint32_t cell_size;
+		uint32_t sprite_count;
+		uint32_t texture_count;
+		uint32_t pvs_set_count;
+		float spawn_x;
+		float spawn_y;
+		uint64_t cells_offset;
+		uint64_t sprites_offset;
+		uint64_t sprite_grid_offset;
+		uint64_t textures_offset;
+		uint64_t pvs_bit_words;
+		uint64_t pvs_cell_sets_offset;
+		uint64_t pvs_sets_offset;
+		uint64_t pvs_bits_offset;
+	};
+
+	struct Map_file_sprite{
+		float x;
+		float y;
+		uint32_t texture_id;
+		uint32_t reserved;
+	};
+
+	/* A loaded map file, every pointer is into the mapping and map.storage keeps it mapped.
+	 * map.pvs is set, also in place, if the file has one.*/
+	struct Map_file{
+		Map map;
+		Vec2f spawn;
+		const Map_file_sprite * sprites;
+		uint32_t sprite_count;
+		const uint32_t * sprite_grid;
+		const uint32_t * textures;
+		uint32_t texture_count;
+	};
+
+	/* Maps path read only, dies if it isn't a map file of this version.*/
+	Map_file load_map_file(const char * path);
+
+	/* sprite_textures holds the TextureID of every sprite in positions, map.pvs goes in if it's set.*/
+	void save_map_file(const char * path, const Map& map, const Vec2f& spawn,
+					   const std::vector<Vec2f>& positions, const std::vector<uint32_t>& sprite_textures);
+}
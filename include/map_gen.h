@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "map.h"
+#include "vec2.h"
+
+namespace rc{
+	/* Parameters for the procedural stress maps. The same seed and parameters always
+	 * produce the same map, so benchmark runs can be compared.*/
+	struct Map_gen_params{
+		int w = 64;
+		int h = 64;
+		uint32_t seed = 1;
+		double wall_density = 0.05;  // chance a carved floor cell is put back as a pillar.
+		int corridor_length = 4;     // how far a maze corridor runs before it may turn, in cells.
+		double open_ratio = 0.3;     // fraction of the interior carved out as rooms, 1.0 is one open hall.
+		int sprites = 0;
+	};
+
+	struct Generated_map{
+		Map map;
+		Vec2f spawn;                 // center of the floor cell closest to the middle of the map.
+		std::vector<Vec2f> sprites;  // world positions, always on floor cells and never on the spawn cell.
+	};
+
+	/* Builds a map out of WALL()/FLCL() cells: a maze of corridors, rooms carved over it
+	 * until open_ratio is reached, pillars scattered with wall_density and a solid border.*/
+	Generated_map generate_map(const Map_gen_params& params);
+}
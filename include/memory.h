@@ -6,7 +6,6 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
-#include "rc_math.h"
 
 #define START_BLOCKS_CAP 1
 #define DEFAULT_BLOCK_CAP 128
@@ -26,12 +25,14 @@ typedef struct{
 	Block * start; // linked list of blocks
 	Block * end;
 	size_t cap; // how many blocks
-	size_t element_size;
+	size_t element_size; // a multiple of align, so every slot is aligned.
+	size_t align;
 	Block * curr_block;
 	FreeAddr * free_addrs;
 }RC_MemPool;
 
 RC_MemPool * RC_create_mempool(size_t cap, size_t element_size);
+RC_MemPool * RC_create_aligned_mempool(size_t cap, size_t element_size, size_t align);
 void * RC_mempool_alloc(RC_MemPool * pool);
 void RC_mempool_free(RC_MemPool * pool, void ** addr);
 void RC_destroy_mempool(RC_MemPool * pool);
@@ -15,6 +15,7 @@ namespace rc{
 		Player(int projection_plane_w);
 		void draw(const Map * map, Engine * engine);
 		void update(const rc::Engine * engine);
+		void set_plane_width(int projection_plane_w);
 
 		public:
 			double dist_from_proj_plane;
@@ -24,5 +25,7 @@ namespace rc{
 			Vec2f position;
 			double speed;
 			double rotation_speed;
+			double column_angle;   // fov / plane width, the view turns a whole number of columns at a time.
+			double turn_remainder; // turn that didn't add up to a column yet.
 	};
 }
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <cassert>
+#include <mutex>
+#include <new>
+#include <utility>
+
+#include "memory.h"
+
+#define POOL_CACHE_SIZE 64 // slots a Pool_cache keeps, it trades half of them with the pool at a time.
+
+namespace rc{
+	template<typename T> struct Pool_cache;
+
+	/*
+	 * Objects of type T in slots of an RC_MemPool, aligned for T. create() and destroy() are a
+	 * pop and a push on the pool's free list, the heap is only asked for whole blocks of
+	 * DEFAULT_BLOCK_CAP slots when every slot is taken. Any thread can use the pool, each call
+	 * takes its mutex; a thread that makes and drops many objects keeps a Pool_cache instead.
+	 * Objects still alive when the pool goes are not destroyed, their memory is freed with it.
+	 * */
+	template<typename T>
+	struct Pool{
+		Pool(size_t blocks = START_BLOCKS_CAP);
+		~Pool();
+		Pool(const Pool&) = delete;
+		Pool& operator=(const Pool&) = delete;
+
+		template<typename... Args>
+		T * create(Args&&... args);
+		void destroy(T * object);
+
+		private:
+			friend Pool_cache<T>;
+
+			RC_MemPool * m_pool;
+			std::mutex m_mutex;
+	};
+
+	/*
+	 * One thread's slots of a Pool. create() and destroy() take and give back slots of its own
+	 * without locking, and only go to the pool, once for POOL_CACHE_SIZE / 2 slots, when it runs
+	 * out or fills up. An object can be destroyed through any cache of its pool, or the pool.
+	 * Whatever slots are left go back to the pool with the cache.
+	 * */
+	template<typename T>
+	struct Pool_cache{
+		Pool_cache(Pool<T>& pool) : m_pool(pool), m_count(0) {};
+		~Pool_cache();
+		Pool_cache(const Pool_cache&) = delete;
+		Pool_cache& operator=(const Pool_cache&) = delete;
+
+		template<typename... Args>
+		T * create(Args&&... args);
+		void destroy(T * object);
+
+		private:
+			Pool<T>& m_pool;
+			void * m_slots[POOL_CACHE_SIZE];
+			int m_count;
+	};
+}
+
+template<typename T>
+rc::Pool<T>::Pool(size_t blocks){
+	m_pool = RC_create_aligned_mempool(blocks, sizeof(T), alignof(T));
+}
+
+template<typename T>
+rc::Pool<T>::~Pool(){
+	RC_destroy_mempool(m_pool);
+}
+
+template<typename T>
+template<typename... Args>
+T * rc::Pool<T>::create(Args&&... args){
+	void * slot;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		slot = RC_mempool_alloc(m_pool);
+	}
+	return new (slot) T(std::forward<Args>(args)...);
+}
+
+template<typename T>
+void rc::Pool<T>::destroy(T * object){
+	assert(object != NULL);
+	object->~T();
+
+	void * slot = object;
+	std::lock_guard<std::mutex> lock(m_mutex);
+	RC_mempool_free(m_pool, &slot);
+}
+
+template<typename T>
+rc::Pool_cache<T>::~Pool_cache(){
+	std::lock_guard<std::mutex> lock(m_pool.m_mutex);
+	for(int i = 0; i < m_count; i++){
+		RC_mempool_free(m_pool.m_pool, &m_slots[i]);
+	}
+}
+
+template<typename T>
+template<typename... Args>
+T * rc::Pool_cache<T>::create(Args&&... args){
+	if(m_count == 0){
+		std::lock_guard<std::mutex> lock(m_pool.m_mutex);
+		for(; m_count < POOL_CACHE_SIZE / 2; m_count++){
+			m_slots[m_count] = RC_mempool_alloc(m_pool.m_pool);
+		}
+	}
+	return new (m_slots[--m_count]) T(std::forward<Args>(args)...);
+}
+
+template<typename T>
+void rc::Pool_cache<T>::destroy(T * object){
+	assert(object != NULL);
+	object->~T();
+
+	if(m_count == POOL_CACHE_SIZE){
+		std::lock_guard<std::mutex> lock(m_pool.m_mutex);
+		for(; m_count > POOL_CACHE_SIZE / 2; m_count--){
+			RC_mempool_free(m_pool.m_pool, &m_slots[m_count - 1]);
+		}
+	}
+	m_slots[m_count++] = object;
+}
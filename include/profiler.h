@@ -0,0 +1,100 @@
+#pragma once
+
+/*
+ * Per stage frame profiler, only built with RC_PROFILE defined, make PROFILE=1. Without it
+ * RC_PROFILE_SCOPE() expands to nothing and none of the types below exist, so the code that
+ * is timed compiles to exactly what it is without the profiler.
+ * */
+#ifdef RC_PROFILE
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#define PROFILE_WINDOW 240 // frames the percentiles are taken over.
+
+#define RC_PROFILE_JOIN_(a, b) a##b
+#define RC_PROFILE_JOIN(a, b) RC_PROFILE_JOIN_(a, b)
+// times the rest of the enclosing block into times.ns[stage].
+#define RC_PROFILE_SCOPE(times, stage) rc::Profile_scope RC_PROFILE_JOIN(profile_scope_, __LINE__)(times, stage)
+
+namespace rc{
+	enum Profile_stage{
+		PROFILE_INPUT,
+		PROFILE_UPDATE,
+		PROFILE_TRAVERSAL,
+		PROFILE_WALLS,
+		PROFILE_FLOOR,
+		PROFILE_CEILING,
+		PROFILE_SPRITE_SORT,
+		PROFILE_SPRITES,
+		PROFILE_UPLOAD,
+		PROFILE_PRESENT,
+
+		PROFILE_STAGES,
+	};
+
+	const char * profile_stage_name(int stage);
+	uint64_t profile_now_ns();
+
+	/* Time a frame spent in every stage. The stages run on the workers add up what every worker
+	 * spent, that's cpu time rather than wall time. A cache line of its own, every worker has one.*/
+	struct alignas(64) Profile_times{
+		uint64_t ns[PROFILE_STAGES];
+
+		inline void clear() {
+			for(int i = 0; i < PROFILE_STAGES; i++) ns[i] = 0;
+		};
+		inline Profile_times& operator+=(const Profile_times& other) {
+			for(int i = 0; i < PROFILE_STAGES; i++) ns[i] += other.ns[i];
+			return *this;
+		};
+	};
+
+	struct Profile_scope{
+		Profile_scope(Profile_times& times, Profile_stage stage) : m_times(times), m_stage(stage), m_start(profile_now_ns()) {};
+		~Profile_scope() { m_times.ns[m_stage] += profile_now_ns() - m_start; };
+
+		private:
+			Profile_times& m_times;
+			Profile_stage m_stage;
+			uint64_t m_start;
+	};
+
+	// in ms.
+	struct Profile_stats{
+		double p50;
+		double p95;
+		double p99;
+	};
+
+	/*
+	 * Keeps the last PROFILE_WINDOW frames for stats(), and writes every frame to the file
+	 * open() was given if any: CSV with a column per stage, or for a path ending in .json,
+	 * Chrome's trace event format with a counter event per frame, which chrome://tracing and
+	 * Perfetto plot as the stages stacked over time.
+	 * */
+	struct Profiler{
+		Profiler();
+		~Profiler();
+
+		void open(const char * path);
+		void add_frame(const Profile_times& times);
+		Profile_stats stats(int stage) const;
+		void print(FILE * out) const;
+		constexpr uint64_t frames() const { return m_count; };
+
+		private:
+			std::vector<Profile_times> m_window; // a ring, frame i is at i % PROFILE_WINDOW.
+			uint64_t m_count;
+			uint64_t m_start_ns;
+			FILE * m_file;
+			bool m_trace;
+	};
+}
+
+#else
+
+#define RC_PROFILE_SCOPE(times, stage)
+
+#endif
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "map.h"
+#include "Workers.h"
+
+#define PVS_NONE 0xffffffff // cell_sets entry of a wall cell, nothing is seen from inside a wall.
+#define PVS_BEAMS 128       // slope intervals each of the four quadrants around a cell is swept in.
+/* Limits of build_pvs(), past them it dies rather than run for hours or out of memory. The
+ * sweeps cost about as much as the sets' bits, so the cap on those bounds the time too, and
+ * keeps the 32 bit offsets of Pvs_set in range. An open 128 x 128 map is 4M words.*/
+#define PVS_MAX_CELLS (1024 * 1024)
+#define PVS_MAX_BIT_WORDS (1ull << 24) // 128 MiB of bits.
+
+namespace rc{
+	/* Cells seen from one floor cell: a bit per cell of the rect [x0, x0 + w) x [y0, y0 + h),
+	 * row major, starting at bit 0 of Pvs::bits[bits].*/
+	struct Pvs_set{
+		uint16_t x0;
+		uint16_t y0;
+		uint16_t w;
+		uint16_t h;
+		uint32_t bits;
+	};
+
+	/*
+	 * Potentially visible set of every floor cell: the floor cells, and the wall cells with a
+	 * face, that can be seen from some point inside it, and the cells next to those. Read only
+	 * like Map::cells and kept alive by storage, a Pvs is either built by build_pvs() or used in
+	 * place from a map file.
+	 * */
+	struct Pvs{
+		int w;
+		int h;
+		const uint32_t * cell_sets; // w * h set indices, row major, PVS_NONE for walls.
+		const Pvs_set * sets;
+		const uint64_t * bits;
+		uint32_t set_count;
+		uint64_t bit_words;
+		std::shared_ptr<const void> storage;
+
+		/* NULL for walls, and for a set index past the sets of a corrupt map file.*/
+		inline const Pvs_set * from(int x, int y) const {
+			uint32_t set = cell_sets[y * w + x];
+			return set == PVS_NONE || set >= set_count ? NULL : &sets[set];
+		};
+
+		/* A map file is only checked section by section when it's loaded, a set whose bits run
+		 * past bit_words sees nothing.*/
+		inline bool visible(const Pvs_set& set, int x, int y) const {
+			unsigned dx = x - set.x0, dy = y - set.y0;
+			if(dx >= set.w || dy >= set.h) return false;
+			if(set.bits + (static_cast<uint64_t>(set.w) * set.h + 63) / 64 > bit_words) return false;
+			uint64_t bit = dy * set.w + dx;
+			return (bits[set.bits + (bit >> 6)] >> (bit & 63)) & 1;
+		};
+	};
+
+	/*
+	 * Sweeps the rays leaving every floor cell as PVS_BEAMS beams per quadrant, see sweep() in
+	 * pvs.cpp, then grows the result by a cell since a sprite is a cell wide. Conservative, no
+	 * cell a ray can reach from inside the cell is left out, but the beams widen as they go so
+	 * far away cells past a narrow gap can be let in too. The cells are split over workers,
+	 * the result doesn't depend on how many there are. Dies on maps of more than PVS_MAX_CELLS
+	 * cells or sets of more than PVS_MAX_BIT_WORDS words all together.
+	 * */
+	Pvs build_pvs(const Map& map, Workers& workers);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+
+#define PACKET_MAX_RAYS 8
+
+namespace rc{
+	/* Instruction sets the packet traversal can run on, best_packet_isa() picks the widest
+	 * one the cpu supports at run time. All of them give bit identical hits.*/
+	enum Packet_isa{
+		PACKET_SCALAR,
+		PACKET_SSE,   // 4 rays per step, sse4.1.
+		PACKET_AVX2,  // 8 rays per step.
+	};
+
+	/* The grid the rays walk, cells are Map::cells in chunks, see Map::index().*/
+	struct Packet_grid{
+		const uint32_t * cells;
+		int w;
+		int h;
+		int chunks_w;
+		float cell_size;
+		uint8_t * visited;   // set to 1 at Map::index() of every floor cell a ray walks through.
+		int visited_spare;   // index of a byte past the grid the simd lanes may scribble on.
+	};
+
+	/* Rays sharing an origin, only the first count lanes are traced. dir must be normalized.*/
+	struct Ray_packet{
+		float origin_x;
+		float origin_y;
+		alignas(32) float dir_x[PACKET_MAX_RAYS];
+		alignas(32) float dir_y[PACKET_MAX_RAYS];
+		int count;
+	};
+
+	struct Packet_hits{
+		alignas(32) float t[PACKET_MAX_RAYS];          // distance along the ray to the wall.
+		alignas(32) int32_t cell_x[PACKET_MAX_RAYS];   // -1 when the ray left the map.
+		alignas(32) int32_t cell_y[PACKET_MAX_RAYS];
+		alignas(32) int32_t vertical[PACKET_MAX_RAYS]; // non zero if the wall was entered across a vertical grid line.
+	};
+
+	Packet_isa best_packet_isa();
+	int packet_width(Packet_isa isa);
+	const char * packet_isa_name(Packet_isa isa);
+
+	/* Same grid walk as Core::cast_ray_dda() in single precision for up to packet_width(isa)
+	 * rays at once. Every lane steps each iteration and lanes that hit something are masked
+	 * off until the whole packet is done.*/
+	void trace_packet(Packet_isa isa, const Packet_grid& grid, const Ray_packet& rays, Packet_hits& hits);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace rc{
+	/* dst[c * dst_stride + r] = src[r * src_stride + c] for every r < rows and c < cols, strides
+	 * are in pixels. Runs on 8x8 avx2 or 4x4 sse tiles inside cache sized blocks, whichever the
+	 * cpu supports, the leftover edges are copied one pixel at a time.*/
+	void transpose_pixels(const uint32_t * src, size_t src_stride, uint32_t * dst, size_t dst_stride, int rows, int cols);
+}
@@ -1,11 +1,12 @@
 #include "RC_Core.h"
+#include "transpose.h"
 #include <iostream>
 #include <algorithm>
+#include <cstring>
 
 #define COLOR_KEY 0x980088ff
 //#define PROJ_PLANE_W 800 #define PROJ_PLANE_H 600
 
-static bool visited_cell[MAP_MAX_SIZE][MAP_MAX_SIZE];
 extern SDL_Texture * sprite_texture;
 extern uint32_t temp_map[8 * 8];
 
@@ -16,33 +17,171 @@ double rc::Core::perpendicular_distance(double viewing_angle, const Vec2f& p, co
 }
 
 rc::Core::Core(size_t proj_plane_w, size_t proj_plane_h, double fov){
-	m_proj_plane_w = proj_plane_w;
-	m_proj_plane_h = proj_plane_h;
-	m_proj_plane_center = proj_plane_h / 2;
-
-	m_hits.resize(m_proj_plane_w, Vec2f(0, 0));
-	m_wall_dists.resize(m_proj_plane_w, 0.0);
-
-	m_angle_step = fov / static_cast<double>(m_proj_plane_w);
-	m_fbuffer = Frame_buffer(proj_plane_w, proj_plane_h);
+	m_map_version = 0;
+	m_sprite_version = 0;
 	m_resources = Resources::instance();
 
 	m_player = std::make_unique<Player>(proj_plane_w);
+	m_player->fov = fov;
 	m_map = std::make_unique<Map>(temp_map, 8, 8);
 
-	m_sprites.emplace_back(Vec2f(100, 100), 4, this);
-	m_sprites.emplace_back(Vec2f(150, 200), 6, this);
+	m_sprites.add(Vec2f(100, 100), 4);
+	m_sprites.add(Vec2f(150, 200), 6);
+	index_sprites();
+
+	m_layer.serial = 0;
+	m_layer_serial = 0;
+	m_rays.last = 0;
+	reset_arena();
+	set_plane_size(proj_plane_w, proj_plane_h);
+	set_frame_buffers(1);
+
+	set_threads(std::thread::hardware_concurrency());
+	m_packet_isa = best_packet_isa();
+
+	m_map->pvs = std::make_shared<Pvs>(build_pvs(*m_map, *m_workers));
+	m_pvs_set = NULL;
+	m_pixel_format = NULL;
+}
+
+/*
+ * Everything that follows from the plane's size: the per column and per row tables, the
+ * constants and the player's distance to the plane. Framebuffers are resized by the next
+ * render() into them, so one that's being copied out on another thread is left alone. The
+ * cached layer and rays were for the old size and are dropped.
+ * */
+void rc::Core::set_plane_size(int w, int h){
+	assert(w > 0 && h > 0);
+	m_proj_plane_w = w;
+	m_proj_plane_h = h;
+	m_proj_plane_center = h / 2;
+
+	m_hits.assign(m_proj_plane_w, Vec2f(0, 0));
+	m_wall_dists.assign(m_proj_plane_w, 0.0);
+	m_ray_angles.assign(m_proj_plane_w, 0.0);
+	m_floor_columns.resize(m_proj_plane_w);
+
+	m_angle_step = m_player->fov / static_cast<double>(m_proj_plane_w);
+	m_player->set_plane_width(m_proj_plane_w);
 
 	// compute some constants.
 	m_constants.half_fov = m_player->fov * 0.5f;
 	m_constants.columns_per_angle = m_proj_plane_w / m_player->fov;
 	m_constants.cell_size_times_dist = static_cast<double>(m_map->cell_size) * m_player->dist_from_proj_plane;
 	m_constants.pheight_times_distplane = static_cast<double>(m_player->height) * m_player->dist_from_proj_plane;
+
+	// from similar triangle we can find the perpendicular distance from player to a floor or ceiling
+	// point on each row, the center row is the horizon and never drawn.
+	m_row_dists.assign(m_proj_plane_h, 0.0);
+	m_row_levels.assign(m_proj_plane_h, 0);
+	for(int y = 0; y < m_proj_plane_h; y++){
+		int row_diff = abs(y - m_proj_plane_center);
+		if(row_diff != 0) m_row_dists[y] = m_constants.pheight_times_distplane / static_cast<double>(row_diff);
+
+		/* Neighbouring pixels on a row are straight_dist / dist_from_proj_plane world units
+		 * apart, a texel per world unit since floor textures are cell sized. Every doubling of
+		 * that is one more mip level.*/
+		double texels_per_pixel = m_row_dists[y] / m_player->dist_from_proj_plane;
+		while(texels_per_pixel >= 2.0){
+			texels_per_pixel *= 0.5;
+			m_row_levels[y]++;
+		}
+	}
+
+	compute_ray_tables();
+
+	m_rays.hits[0].assign(m_proj_plane_w, Ray_hit());
+	m_rays.hits[1].assign(m_proj_plane_w, Ray_hit());
+	m_rays.valid = false;
+	m_layer.serial = 0;
+	m_last_key = {};
+}
+
+void rc::Core::compute_ray_tables(){
+	m_column_dirs.resize(m_proj_plane_w);
+
+	for(int x = 0; x < m_proj_plane_w; x++){
+		double offset = to_rad(m_constants.half_fov - x * m_angle_step);
+		m_column_dirs[x] = Vec2f(cos(offset), sin(offset));
+	}
+}
+
+/* Per frame ray setup for the current viewing angle.*/
+void rc::Core::compute_view(){
+	// move the starting ray_angle direction to the leftmost part of the arc
+	double ray_angle = m_player->viewing_angle + (m_constants.half_fov);
+
+	for(int x = 0; x < m_proj_plane_w; x++){
+		if(ray_angle > 360.0) ray_angle -= 360.0;
+		if(ray_angle < 0.0) ray_angle += 360.0;
+
+		assert(ray_angle >= 0 && ray_angle <= 360.0);
+
+		m_ray_angles[x] = ray_angle;
+		ray_angle -= m_angle_step;
+	}
+
+	double viewing_angle = to_rad(m_player->viewing_angle);
+	m_forward = Vec2f(cos(viewing_angle), -sin(viewing_angle));
+	m_left = Vec2f(-sin(viewing_angle), -cos(viewing_angle));
 }
 
-rc::Core::~Core(){ };
+rc::Core::~Core(){
+	if(m_pixel_format) SDL_FreeFormat(m_pixel_format);
+};
+
+void rc::Core::set_threads(size_t count){
+	m_workers = std::make_unique<Workers>(count);
+#ifdef RC_PROFILE
+	m_profile.assign(m_workers->count(), Profile_times());
+#endif
+	m_visited.resize(m_workers->count());
+	reset_visited();
+}
 
-double rc::Core::find_h_intercept(double ray_angle, Vec2f& h_hit, Vec2i& map_coords){
+void rc::Core::reset_visited(){
+	map_changed();
+	for(auto& visited : m_visited){
+		// one spare byte past the grid for the packet traversal, see Packet_grid.
+		visited.cells.reset(static_cast<uint8_t *>(calloc(m_map->cell_count() + 1, 1)));
+		RC_DIE(!visited.cells, "out of memory");
+		visited.x0 = visited.y0 = 0;
+		visited.x1 = visited.y1 = -1;
+	}
+}
+
+/* Clears what the last frame marked, a run of chunks per chunk row.*/
+void rc::Core::clear_visited(){
+	for(auto& visited : m_visited){
+		for(int cy = visited.y0 >> MAP_CHUNK_SHIFT; cy <= visited.y1 >> MAP_CHUNK_SHIFT; cy++){
+			int cx0 = visited.x0 >> MAP_CHUNK_SHIFT;
+			int cx1 = visited.x1 >> MAP_CHUNK_SHIFT;
+			size_t first = static_cast<size_t>(cy) * m_map->chunks_w + cx0;
+			memset(&visited.cells[first * MAP_CHUNK_CELLS], 0, (cx1 - cx0 + 1) * MAP_CHUNK_CELLS);
+		}
+
+		visited.x0 = visited.x1 = std::clamp(static_cast<int>(m_player->position.x / m_map->cell_size), 0, m_map->w - 1);
+		visited.y0 = visited.y1 = std::clamp(static_cast<int>(m_player->position.y / m_map->cell_size), 0, m_map->h - 1);
+	}
+}
+
+/* Grows the worker's visited rect to the cell a walk stopped on, walks that left the map stop on its edge.*/
+void rc::Core::cover_visited(int worker, int x, int y){
+	Visited_cells& visited = m_visited[worker];
+	x = std::clamp(x, 0, m_map->w - 1);
+	y = std::clamp(y, 0, m_map->h - 1);
+	visited.x0 = std::min(visited.x0, x);
+	visited.y0 = std::min(visited.y0, y);
+	visited.x1 = std::max(visited.x1, x);
+	visited.y1 = std::max(visited.y1, y);
+}
+
+// the cpu may not support isa, then the best one it has is used instead.
+void rc::Core::set_packet_isa(Packet_isa isa){
+	m_packet_isa = std::min(isa, best_packet_isa());
+}
+
+double rc::Core::find_h_intercept(double ray_angle, Vec2f& h_hit, Vec2i& map_coords, int worker){
 	int step_y;
 	double delta_step_x;
 
@@ -75,23 +214,25 @@ double rc::Core::find_h_intercept(double ray_angle, Vec2f& h_hit, Vec2i& map_coo
 
 	double distance = DBL_MAX;
 
+	// a ray along the x axis never crosses a horizontal grid line, compute_view() can leave it at 360 too.
 	bool hit = false;
-	if(ray_angle != 0 && ray_angle != 180){
+	if(ray_angle != 0 && ray_angle != 180 && ray_angle != 360){
 		while(!hit){
 			int x = static_cast<int>(h_hit.x) / m_map->cell_size;
 			int y = static_cast<int>(h_hit.y) / m_map->cell_size;
 			if(x >= m_map->w || x < 0 || y >= m_map->h || y < 0){
+				cover_visited(worker, x, y);
 				map_coords.x = INT_MAX;
 				map_coords.y = INT_MAX;
 				break;
 			}else if(m_map->at(x, y) & WALL_BIT){
-
+				cover_visited(worker, x, y);
 				map_coords.x = x;
 				map_coords.y = y;
 				hit = true;
 				distance = perpendicular_distance(m_player->viewing_angle, m_player->position, h_hit);
 			}else{
-				visited_cell[y][x] = true;
+				mark_visited(worker, x, y);
 				h_hit.x += delta_step_x;
 				h_hit.y += static_cast<double>(step_y);
 			}
@@ -101,7 +242,7 @@ double rc::Core::find_h_intercept(double ray_angle, Vec2f& h_hit, Vec2i& map_coo
 	return distance;
 }
 
-double rc::Core::find_v_intercept(double ray_angle, Vec2f& v_hit, Vec2i& map_coords){
+double rc::Core::find_v_intercept(double ray_angle, Vec2f& v_hit, Vec2i& map_coords, int worker){
 	int step_x;
 	double delta_step_y;
 
@@ -129,22 +270,25 @@ double rc::Core::find_v_intercept(double ray_angle, Vec2f& v_hit, Vec2i& map_coo
 
 	double distance = DBL_MAX;
 
+	// and one along the y axis never crosses a vertical one.
 	bool hit = false;
-	if(ray_angle != 180.0 && ray_angle != 90.0){
+	if(ray_angle != 90.0 && ray_angle != 270.0){
 		while(!hit){
 			int x = static_cast<int>(v_hit.x) / m_map->cell_size;
 			int y = static_cast<int>(v_hit.y) / m_map->cell_size;
 			if(x >= m_map->w || x < 0 || y >= m_map->h || y < 0){
+				cover_visited(worker, x, y);
 				map_coords.x = INT_MAX;
 				map_coords.y = INT_MAX;
 				break;
 			}else if(m_map->at(x, y) & WALL_BIT){
+				cover_visited(worker, x, y);
 				map_coords.x = x;
 				map_coords.y = y;
 				distance = perpendicular_distance(m_player->viewing_angle, m_player->position, v_hit);
 				hit = true;
 			}else{
-				visited_cell[y][x] = true;
+				mark_visited(worker, x, y);
 				v_hit.x += static_cast<double>(step_x);
 				v_hit.y += delta_step_y;
 			}
@@ -154,6 +298,182 @@ double rc::Core::find_v_intercept(double ray_angle, Vec2f& v_hit, Vec2i& map_coo
 	return distance;
 }
 
+/*
+ * Grid walk along a direction vector (DDA). Instead of two separate walks over the horizontal
+ * and the vertical grid lines, keep the ray distance to the next crossing of each kind and
+ * always step across the nearer one, so cells are visited in the order the ray enters them.
+ * No trig, and directions parallel to an axis need no special casing, that axis just never
+ * gets crossed.
+ *
+ * dir must be normalized, cos_offset is the cosine of the angle between the ray and the
+ * viewing direction, the distance along the ray times it is the fisheye corrected distance.
+ * */
+rc::Core::Ray_hit rc::Core::cast_ray_dda(const Vec2f& dir, double cos_offset, int worker){
+	const double cell_size = static_cast<double>(m_map->cell_size);
+	const Vec2f& p = m_player->position;
+
+	int map_x = static_cast<int>(p.x / cell_size);
+	int map_y = static_cast<int>(p.y / cell_size);
+
+	int step_x = dir.x < 0.0 ? -1 : 1;
+	int step_y = dir.y < 0.0 ? -1 : 1;
+
+	// ray distance between two consecutive vertical (x) or horizontal (y) grid lines
+	double delta_x = dir.x != 0.0 ? fabs(cell_size / dir.x) : DBL_MAX;
+	double delta_y = dir.y != 0.0 ? fabs(cell_size / dir.y) : DBL_MAX;
+
+	// ray distance to the first one of each
+	double side_x = DBL_MAX, side_y = DBL_MAX;
+	if(dir.x != 0.0) side_x = (dir.x < 0.0 ? p.x - map_x * cell_size : (map_x + 1) * cell_size - p.x) / fabs(dir.x);
+	if(dir.y != 0.0) side_y = (dir.y < 0.0 ? p.y - map_y * cell_size : (map_y + 1) * cell_size - p.y) / fabs(dir.y);
+
+	Ray_hit hit;
+	hit.cell = Vec2i(INT_MAX, INT_MAX);
+	hit.dist = DBL_MAX;
+	hit.texture_x = 0;
+
+	while(true){
+		double t;
+		bool vertical_line;
+
+		if(side_x < side_y){
+			t = side_x;
+			side_x += delta_x;
+			map_x += step_x;
+			vertical_line = true;
+		}else{
+			t = side_y;
+			side_y += delta_y;
+			map_y += step_y;
+			vertical_line = false;
+		}
+
+		if(map_x >= m_map->w || map_x < 0 || map_y >= m_map->h || map_y < 0){
+			cover_visited(worker, map_x, map_y);
+			break;
+		}else if(m_map->at(map_x, map_y) & WALL_BIT){
+			cover_visited(worker, map_x, map_y);
+			hit.point = p + (dir * t);
+			hit.cell = Vec2i(map_x, map_y);
+			hit.dist = t * cos_offset;
+			hit.texture_x = vertical_line ? static_cast<int>(hit.point.y) % 64 : static_cast<int>(hit.point.x) % 64;
+			break;
+		}else{
+			mark_visited(worker, map_x, map_y);
+		}
+	}
+
+	return hit;
+}
+
+rc::Core::Ray_hit rc::Core::cast_ray(int x, uint32_t flags, int worker){
+	if(flags & TRAVERSAL_DDA){
+		const Vec2f& offset = m_column_dirs[x];
+		Vec2f dir = (m_forward * offset.x) + (m_left * offset.y);
+		return cast_ray_dda(dir, offset.x, worker);
+	}
+
+	Vec2i map_coords_h, map_coords_v;
+	Vec2f h_hit, v_hit;
+
+	double ray_angle = m_ray_angles[x];
+
+	double h_dist = find_h_intercept(ray_angle, h_hit, map_coords_h, worker);
+	double v_dist = find_v_intercept(ray_angle, v_hit, map_coords_v, worker);
+
+	Ray_hit hit;
+	hit.point = h_dist < v_dist ? h_hit: v_hit;
+	hit.cell = h_dist < v_dist ? map_coords_h : map_coords_v;
+	hit.dist = std::min(h_dist, v_dist);
+	hit.texture_x = h_dist < v_dist ? static_cast<int>(h_hit.x) % 64 : static_cast<int>(v_hit.y) % 64;
+
+	return hit;
+}
+
+/*
+ * Traces count adjacent columns starting at x with trace_packet(). The hits come back as a
+ * distance along each ray, the wall point is rebuilt here: the coordinate across the grid
+ * line that was crossed is the line itself, so the texture column never lands on the wrong
+ * side of it because of float rounding.
+ * */
+void rc::Core::cast_ray_packet(int x, int count, Ray_hit * hits, int worker){
+	const double cell_size = static_cast<double>(m_map->cell_size);
+	const Vec2f& p = m_player->position;
+
+	Packet_grid grid;
+	grid.cells = m_map->cells;
+	grid.w = m_map->w;
+	grid.h = m_map->h;
+	grid.chunks_w = m_map->chunks_w;
+	grid.cell_size = static_cast<float>(cell_size);
+	grid.visited = m_visited[worker].cells.get();
+	grid.visited_spare = m_map->cell_count();
+
+	Ray_packet rays;
+	rays.origin_x = static_cast<float>(p.x);
+	rays.origin_y = static_cast<float>(p.y);
+	rays.count = count;
+
+	Vec2f dirs[PACKET_MAX_RAYS];
+	int width = packet_width(m_packet_isa);
+	for(int i = 0; i < width; i++){
+		// lanes past count are never traced, they just get a valid direction.
+		const Vec2f& offset = m_column_dirs[x + std::min(i, count - 1)];
+		dirs[i] = (m_forward * offset.x) + (m_left * offset.y);
+		rays.dir_x[i] = static_cast<float>(dirs[i].x);
+		rays.dir_y[i] = static_cast<float>(dirs[i].y);
+	}
+
+	Packet_hits packet;
+	trace_packet(m_packet_isa, grid, rays, packet);
+
+	for(int i = 0; i < count; i++){
+		Ray_hit& hit = hits[i];
+		if(packet.cell_x[i] < 0){
+			// t is where the ray left the map, a cell either way covers the float rounding.
+			int exit_x = static_cast<int>(floor((p.x + dirs[i].x * packet.t[i]) / cell_size));
+			int exit_y = static_cast<int>(floor((p.y + dirs[i].y * packet.t[i]) / cell_size));
+			cover_visited(worker, exit_x - 1, exit_y - 1);
+			cover_visited(worker, exit_x + 1, exit_y + 1);
+
+			hit.cell = Vec2i(INT_MAX, INT_MAX);
+			hit.dist = DBL_MAX;
+			hit.texture_x = 0;
+			continue;
+		}
+
+		double t = packet.t[i];
+		hit.cell = Vec2i(packet.cell_x[i], packet.cell_y[i]);
+		cover_visited(worker, hit.cell.x, hit.cell.y);
+		hit.dist = t * m_column_dirs[x + i].x;
+
+		if(packet.vertical[i]){
+			hit.point.x = (dirs[i].x < 0.0 ? hit.cell.x + 1 : hit.cell.x) * cell_size;
+			hit.point.y = p.y + dirs[i].y * t;
+			hit.texture_x = static_cast<int>(hit.point.y) % 64;
+		}else{
+			hit.point.x = p.x + dirs[i].x * t;
+			hit.point.y = (dirs[i].y < 0.0 ? hit.cell.y + 1 : hit.cell.y) * cell_size;
+			hit.texture_x = static_cast<int>(hit.point.x) % 64;
+		}
+	}
+}
+
+// hits[i] is the hit for column x0 + i.
+void rc::Core::cast_rays(int x0, int x1, uint32_t flags, Ray_hit * hits, int worker){
+	if(flags & TRAVERSAL_PACKET){
+		int width = packet_width(m_packet_isa);
+		for(int x = x0; x < x1; x += width){
+			cast_ray_packet(x, std::min(width, x1 - x), &hits[x - x0], worker);
+		}
+		return;
+	}
+
+	for(int x = x0; x < x1; x++){
+		hits[x - x0] = cast_ray(x, flags, worker);
+	}
+}
+
 void rc::Core::draw_wall_slice(int y_top, int y_bot, int x, uint32_t color){
 	if(y_top < 0)
 		y_top = 0;
@@ -164,19 +484,22 @@ void rc::Core::draw_wall_slice(int y_top, int y_bot, int x, uint32_t color){
 	for(int y = y_top; y < y_bot; y++){
 		assert(x >= 0 && x < m_proj_plane_w);
 		assert(y >= 0 && y < m_proj_plane_h);
-		m_fbuffer.set_pixel(x, y, color);
+		m_fbuffer->set_pixel(x, y, color);
 	}
 }
 
 ///*Draws a texture mapped wall slice for the current x value*/
 //
-void rc::Core::draw_textmapped_wall_slice(int texture_x, int slice_height, int screen_x, SDL_Surface * texture){
-	assert(texture != NULL);
-
+void rc::Core::draw_textmapped_wall_slice(int texture_x, int slice_height, int screen_x, const Texture& texture, bool mipmapped){
 	int pixel_y;
 	int texture_y;
 
-	size_t texture_size = texture->w;
+	// far away slices squeeze the texture into a few pixels, read a level that is about that tall.
+	int level = mipmapped ? texture.level_for(texture.h, slice_height) : 0;
+	const Mip_level& mip = texture.level(level);
+	texture_x >>= level;
+
+	size_t texture_size = mip.h;
 	int start_y = m_proj_plane_center - (slice_height / 2);
 
 	for(int i = 0; i < slice_height; i++){
@@ -188,129 +511,146 @@ void rc::Core::draw_textmapped_wall_slice(int texture_x, int slice_height, int s
 			*Scaling the original texture to column height*/
 			texture_y = ((i * texture_size) / slice_height);
 
-			uint32_t * pixels = reinterpret_cast<uint32_t *>(texture->pixels);
-			uint32_t pixel_color = pixels[texture_y * texture->w + texture_x];
-			m_fbuffer.set_pixel(screen_x, pixel_y, pixel_color);
+			uint32_t pixel_color = mip.pixels[texture_y * mip.w + texture_x];
+			m_fbuffer->set_pixel(screen_x, pixel_y, pixel_color);
 
 		}
 	}
 }
 
 /*
- * When drawing a wall slice is finished, We can draw the corresponding  slice for the 
- * previously
- * rendered wall slice. The process in this case will be reversed, instead of casting rays 
- * in world space, finding the distance to wall slicees and corresponding height in screen space,
- * will be finding a position in world space from a position in screen space.
- * (screen_x, y) -> point in world space, we'll map this point to a  texture pixel color
+ * When the walls are done, the floor and the ceiling are drawn in the rows above and below them.
+ * The process in this case will be reversed, instead of casting rays in world space, finding
+ * the distance to wall slices and corresponding height in screen space, will be finding a
+ * position in world space from a position in screen space.
+ * (screen_x, y) -> point in world space, we'll map this point to a texture pixel color
  * and use that color to draw the (screen_x, y) pixel on the screen.
- *  y E [wall_slice_bottom_y, plane_height]
  *
- *  Using similar triangle equation and some trig we find all the values we need.
+ * Using similar triangle equation and some trig we find all the values we need: the straight
+ * distance to a floor point only depends on the row, and the ray direction and the cosine of
+ * its angle with the viewing direction only depend on the column. So the floor is drawn a row
+ * at a time, one division per row for the straight distance, the column values come from
+ * m_floor_columns and the framebuffer is written left to right. A column only gets floor
+ * below its wall and ceiling above it, the same pixels the old per column slices drew.
+ *
+ * The columns are equal angle steps apart, not equal steps on the projection plane, so the
+ * world point does not move linearly along a row. Each pixel still does its own division to
+ * keep the image exactly the same as the per column version.
  * */
-void rc::Core::draw_floor_slice(double ray_angle, int screen_x, int wall_bottom_y){
-	assert(m_player != NULL);
-
-	Vec2f P;
-	double straight_dist_to_P; // the straight distance to the  point P.
-
-	// ray is assumed normalized
-	Vec2f ray_dir(cos(to_rad(ray_angle)), -sin(to_rad(ray_angle)));
-
+void rc::Core::set_floor_column(int x, int wall_top, int wall_bot){
+	double ray_angle = m_ray_angles[x];
 	double beta = m_player->viewing_angle - ray_angle;
-	double cosine_beta = cos(to_rad(beta));
 
-	for(int y = wall_bottom_y; y < m_proj_plane_h; y++){ // the range mentioned above
-		int row_diff = y - m_proj_plane_center;
-		// from similar triangle we can find the perpendicular distance from player to P.
-		straight_dist_to_P = m_constants.pheight_times_distplane / static_cast<double>(row_diff);
+	Floor_column& column = m_floor_columns[x];
+	// ray is assumed normalized
+	column.ray_dir = Vec2f(cos(to_rad(ray_angle)), -sin(to_rad(ray_angle)));
+	column.cosine_beta = cos(to_rad(beta));
+	column.wall_top = wall_top;
+	column.wall_bot = wall_bot;
+}
 
-		/* We can derive this by looking a the scene from a top down perspective.
-		   After finding the real distace we can just scale the ray by this value
-		   to find p. */
+/*
+ * Color of the floor (texture_shift 16) or ceiling (texture_shift 8) texel straight_dist_to_P
+ * away along the column's ray from mip level, false if that lands outside the map or on a wall cell.
+ * */
+inline bool rc::Core::floor_texel(const Floor_column& column, double straight_dist_to_P, int texture_shift, int level, uint32_t& color) const {
+	/* We can derive this by looking a the scene from a top down perspective.
+	   After finding the real distace we can just scale the ray by this value
+	   to find p. */
+	double real_distance_to_P = straight_dist_to_P / column.cosine_beta;
+	Vec2f P = m_player->position + (column.ray_dir * real_distance_to_P);
 
-		double real_distance_to_P = straight_dist_to_P / cosine_beta;
-		P = m_player->position + (ray_dir * real_distance_to_P);
+	int map_x = P.x / m_map->cell_size;
+	int map_y = P.y / m_map->cell_size;
 
-		int map_x = P.x / m_map->cell_size;
-		int map_y = P.y / m_map->cell_size;
+	if(map_x < 0 || map_x >= m_map->w || map_y < 0 || map_y >= m_map->h) return false;
 
-		if(map_x >= 0 && map_x < m_map->w && map_y >= 0 && map_y < m_map->h){
-			int texture_x = static_cast<int>(P.x) % m_map->cell_size;
-			int texture_y = static_cast<int>(P.y) % m_map->cell_size;
+	uint32_t cell_data = m_map->at(map_x, map_y);
+	if(!(cell_data & FLOOR_CEIL_BIT)) return false;
 
-			uint32_t cell_data = m_map->at(map_x, map_y);
-			if(cell_data & FLOOR_CEIL_BIT){
-				int text_index = (int)((cell_data >> 16) & 0xff);
+	int texture_x = static_cast<int>(P.x) % m_map->cell_size;
+	int texture_y = static_cast<int>(P.y) % m_map->cell_size;
 
-				assert(text_index >= 0);
-				SDL_Surface * texture = m_resources->get_surface(text_index);
-				assert(texture != NULL);
+	const Texture * texture = m_resources->texture((cell_data >> texture_shift) & 0xff);
+	assert(texture != NULL);
+	assert(texture_x >= 0 && texture_x < texture->w &&
+		   texture_y >= 0 && texture_y < texture->h);
 
-				assert(texture_x >= 0 && texture_x < texture->w &&
-					   texture_y >= 0 && texture_y < texture->h);
+	const Mip_level& mip = texture->level(level);
+	color = mip.pixels[(texture_y >> level) * mip.w + (texture_x >> level)];
+	return true;
+}
 
-				uint32_t * pixels = reinterpret_cast<uint32_t*>(texture->pixels);
-				uint32_t pixel_color = pixels[texture_y * texture->w + texture_x];
-				m_fbuffer.set_pixel(screen_x, y, pixel_color);
+void rc::Core::draw_floor_row(int y, uint32_t flags){
+	if(y <= m_proj_plane_center) return; // the horizon is infinitely far away.
 
-			}
+	uint32_t * row = &m_fbuffer->pixels[y * m_fbuffer->y_stride];
+	double straight_dist_to_P = m_row_dists[y];
+	int level = (flags & TEXTURE_MIPMAPS) ? m_row_levels[y] : 0;
+	uint32_t color;
 
+	for(int x = 0; x < m_proj_plane_w; x++){
+		if(y >= m_floor_columns[x].wall_bot && floor_texel(m_floor_columns[x], straight_dist_to_P, 16, level, color)){
+			row[x] = color;
 		}
 	}
-
 }
 
 /* 
- * This function is symetric to the  slice drawing function.
- * It will draw the corresponding ceiling slice for a given column screen_x.
- * The process of finding the world point P in the ceiling is completley symetric 
- * to process of findig a point P for a  cast. both  and celing drawing could be
- * merged into a single function, however since this raycasting engine will have vertical
- * movement and possible flying, it's better to keep them seperate.
+ * This function is symetric to the floor row drawing function.
+ * The process of finding the world point P in the ceiling is completley symetric to process
+ * of findig a point P for a floor pixel, only the texture comes from a different byte of the
+ * cell. Since this raycasting engine will have vertical movement and possible flying, the
+ * rows are still drawn separately.
  * */
+void rc::Core::draw_ceiling_row(int y, uint32_t flags){
+	if(y >= m_proj_plane_center) return;
 
-void rc::Core::draw_celing_slice(double ray_angle, int screen_x, int wall_top){
-	double straight_dist_to_P;
-	double real_dist_to_P;
-
-	double beta = ray_angle - m_player->viewing_angle;
-	double cosine_beta = cos(to_rad(beta));
-
-	Vec2f ray_dir(cos(to_rad(ray_angle)), -sin(to_rad(ray_angle)));
-	Vec2f P;
-
-	for(int y = wall_top; y >= 0; y--){
-		int row_diff = m_proj_plane_center - y;
-
-		straight_dist_to_P = m_constants.pheight_times_distplane / static_cast<double>(row_diff);
-		real_dist_to_P = straight_dist_to_P / cosine_beta;
+	uint32_t * row = &m_fbuffer->pixels[y * m_fbuffer->y_stride];
+	double straight_dist_to_P = m_row_dists[y];
+	int level = (flags & TEXTURE_MIPMAPS) ? m_row_levels[y] : 0;
+	uint32_t color;
 
-		P = m_player->position + (ray_dir * real_dist_to_P);
-
-		int map_x = P.x / m_map->cell_size;
-		int map_y = P.y / m_map->cell_size;
+	for(int x = 0; x < m_proj_plane_w; x++){
+		if(y <= m_floor_columns[x].wall_top && floor_texel(m_floor_columns[x], straight_dist_to_P, 8, level, color)){
+			row[x] = color;
+		}
+	}
+}
 
-		if(map_x >= 0 && map_x < m_map->w && map_y >= 0 && map_y < m_map->h){
-			int texture_x = static_cast<int>(P.x) % m_map->cell_size;
-			int texture_y = static_cast<int>(P.y) % m_map->cell_size;
+/* Rows y0..y1-1, floor below the horizon and ceiling above it.*/
+void rc::Core::draw_floor_ceiling_rows(int y0, int y1, uint32_t flags){
+	for(int y = y0; y < y1; y++){
+		if(y > m_proj_plane_center){
+			draw_floor_row(y, flags);
+		}else{
+			draw_ceiling_row(y, flags);
+		}
+	}
+}
 
-			uint32_t cell_data = m_map->at(map_x, map_y);
-			if(cell_data & FLOOR_CEIL_BIT){
-				int ceiling_text_i = (cell_data >> 8) & 0xff;
-				assert(ceiling_text_i >= 0);
+/* The same pixels as the row functions above, for a column major framebuffer where a column
+ * is the contiguous direction.*/
+void rc::Core::draw_floor_column(int x, uint32_t flags){
+	const Floor_column& column = m_floor_columns[x];
+	uint32_t * pixels = &m_fbuffer->pixels[x * m_proj_plane_h];
+	bool mipmapped = flags & TEXTURE_MIPMAPS;
+	uint32_t color;
 
-				SDL_Surface * ceiling_texture = m_resources->get_surface(ceiling_text_i);
-				assert(ceiling_texture != NULL);
+	for(int y = std::max(column.wall_bot, m_proj_plane_center + 1); y < m_proj_plane_h; y++){
+		if(floor_texel(column, m_row_dists[y], 16, mipmapped ? m_row_levels[y] : 0, color)) pixels[y] = color;
+	}
+}
 
-				assert(texture_x >= 0 && texture_x < ceiling_texture->w &&
-					   texture_y >= 0 && texture_y < ceiling_texture->h);
+void rc::Core::draw_ceiling_column(int x, uint32_t flags){
+	const Floor_column& column = m_floor_columns[x];
+	uint32_t * pixels = &m_fbuffer->pixels[x * m_proj_plane_h];
+	bool mipmapped = flags & TEXTURE_MIPMAPS;
+	uint32_t color;
 
-				uint32_t * pixels = reinterpret_cast<uint32_t *>(ceiling_texture->pixels);
-				uint32_t pixel_color = pixels[texture_y * ceiling_texture->w + texture_x];
-				m_fbuffer.set_pixel(screen_x, y, pixel_color);
-			}
-		}
+	int ceiling_end = std::min(column.wall_top, m_proj_plane_center - 1);
+	for(int y = 0; y <= ceiling_end; y++){
+		if(floor_texel(column, m_row_dists[y], 8, mipmapped ? m_row_levels[y] : 0, color)) pixels[y] = color;
 	}
 }
 
@@ -340,8 +680,8 @@ void rc::Core::draw_celing_slice(double ray_angle, int screen_x, int wall_top){
  * then screen_columns_for_q = q * (proj_plane_w / fov) = screen_x;
  *
  * */
-rc::Vec2i rc::Core::sprite_world_2_screen(const rc::Sprite& sprite){
-	Vec2f sprite_dir = sprite.position - m_player->position;
+rc::Vec2i rc::Core::sprite_world_2_screen(const Vec2f& position){
+	Vec2f sprite_dir = position - m_player->position;
 
 	double sprite_angle = to_deg(atan2(-sprite_dir.y, sprite_dir.x));
 
@@ -370,91 +710,673 @@ SDL_Rect rc::Core::sprite_screen_dimensions(int screen_x, double dist_to_sprite)
 			sprite_h, sprite_h};
 }
 
-bool sprite_cmp(const rc::Sprite& a, const rc::Sprite& b){
-	return b.last_dist_to_player < a.last_dist_to_player;
+void rc::Core::index_sprites(){
+	std::vector<Vec2f> positions(m_sprites.size());
+	for(size_t i = 0; i < m_sprites.size(); i++){
+		positions[i] = m_sprites.position(i);
+	}
+
+	auto grid = std::make_shared<std::vector<uint32_t>>(bucket_sprites(*m_map, positions.data(), positions.size()));
+	m_sprite_grid.cell_start = grid->data();
+	m_sprite_grid.sprites = grid->data() + static_cast<size_t>(m_map->w) * m_map->h + 1;
+	m_sprite_grid.count = m_sprites.size();
+	m_sprite_grid.storage = grid;
+	find_sprite_cells();
 }
 
-void rc::Core::render_sprites(){
-	std::sort(m_sprites.begin(), m_sprites.end(), sprite_cmp);
-	for(auto& sprite : m_sprites){
-		auto screen_coords = sprite_world_2_screen(sprite);
+void rc::Core::find_sprite_cells(){
+	sprites_changed();
+	// the cell bucket_sprites() puts it in, sprites off the map go in the nearest edge cell.
+	for(size_t i = 0; i < m_sprites.size(); i++){
+		int x = std::clamp(static_cast<int>(m_sprites.x[i] / m_map->cell_size), 0, m_map->w - 1);
+		int y = std::clamp(static_cast<int>(m_sprites.y[i] / m_map->cell_size), 0, m_map->h - 1);
+		m_sprites.cell[i] = y * m_map->w + x;
+	}
+}
 
-		Vec2f sprite_dir = sprite.position - m_player->position;
-		double dist_to_sprite = sprite_dir.length();
+/*
+ * Swaps in a map file. The cells and the sprite grid are read from the mapping as they are,
+ * only the sprites themselves are built here, so the cost is the sprites and the pages the
+ * first frames touch.
+ * */
+void rc::Core::load_map(const Map_file& file){
+	RC_DIE(file.map.cell_size != m_map->cell_size, "map file cell size doesn't match the renderer's");
+	m_resources->build_atlas();
+	for(uint32_t i = 0; i < file.texture_count; i++){
+		RC_DIE(!m_resources->texture(file.textures[i]), "map file references a texture that isn't loaded");
+	}
+
+	m_map = std::make_unique<Map>(file.map);
 
-		auto sprite_dim = sprite_screen_dimensions(screen_coords.x, dist_to_sprite);
-		sprite.draw(sprite_dim, dist_to_sprite);
+	m_sprites.clear();
+	m_sprites.reserve(file.sprite_count);
+	for(uint32_t i = 0; i < file.sprite_count; i++){
+		m_sprites.add(Vec2f(file.sprites[i].x, file.sprites[i].y), file.sprites[i].texture_id);
 	}
+
+	m_sprite_grid.cell_start = file.sprite_grid;
+	m_sprite_grid.sprites = file.sprite_grid + static_cast<size_t>(file.map.w) * file.map.h + 1;
+	m_sprite_grid.count = file.sprite_count;
+	m_sprite_grid.storage = file.map.storage;
+	find_sprite_cells();
+
+	m_player->position = file.spawn;
+	reset_visited();
 }
 
-const uint32_t * rc::Core::render(uint32_t flags){ 
-	// move the starting ray_angle direction to the leftmost part of the arc
-	double ray_angle = m_player->viewing_angle + (m_constants.half_fov);
+void rc::Core::find_pvs_set(uint32_t flags){
+	m_pvs_set = NULL;
+	if(!(flags & VISIBILITY_PVS) || !m_map->pvs) return;
+
+	int x = static_cast<int>(floor(m_player->position.x / m_map->cell_size));
+	int y = static_cast<int>(floor(m_player->position.y / m_map->cell_size));
+	if(x < 0 || x >= m_map->w || y < 0 || y >= m_map->h) return;
+
+	// inside a wall nothing is known, then nothing is culled.
+	m_pvs_set = m_map->pvs->from(x, y);
+}
+
+/*
+ * Finds the sprites that can show up this frame without looking at the rest. A sprite is drawn
+ * only in columns whose wall is farther away than the sprite, so nothing past the farthest wall
+ * of the frame can pass the depth test: only the cells under the view up to that depth are
+ * visited. Every sprite there is then tested against the two edges of the fov, pushed out by
+ * half a cell since a sprite is a cell wide, and against the near side. With a pvs set for the
+ * player's cell, the ones that pass but can't show up in any of their columns are dropped,
+ * see pvs_sees_sprite(), so the frame is the same with and without it.
+ *
+ * Only the sprites that pass get a distance and a place in m_sprites.order, nearest first, and
+ * the walk over it stops once MAX_SPRITES have passed, which keeps the nearest ones. The result
+ * is reversed, back to front.
+ * */
+void rc::Core::cull_sprites(){
+	m_visible_sprites.clear();
+	m_sprite_candidates.clear();
+	if(m_sprites.empty()) return;
+
+	const Vec2f& p = m_player->position;
+	double cell_size = m_map->cell_size;
+	double margin = cell_size * 0.5;
+
+	// rays that left the map have an infinite depth, nothing is farther than the map's diagonal.
+	double max_depth = Vec2f(m_map->w * cell_size, m_map->h * cell_size).length();
+	double wall_depth = *std::max_element(m_wall_dists.begin(), m_wall_dists.end());
+	max_depth = std::min(max_depth, wall_depth) + margin;
+
+	double cos_half = cos(to_rad(m_constants.half_fov));
+	double sin_half = sin(to_rad(m_constants.half_fov));
+	double tan_half = sin_half / cos_half;
+
+	// outward normals of the left and right edges of the view.
+	Vec2f left_normal = (m_left * cos_half) - (m_forward * sin_half);
+	Vec2f right_normal = (m_left * -cos_half) - (m_forward * sin_half);
+
+	/* A sprite that passes is less than max_depth ahead and at most margin / cos_half past an
+	 * edge to the side, inside the trapezoid between these four corners.*/
+	double near_side = margin / cos_half;
+	double far_side = max_depth * tan_half + near_side;
+	Vec2f far = p + (m_forward * max_depth);
+	Vec2f corners[4] = {p + (m_left * near_side), p - (m_left * near_side), far + (m_left * far_side), far - (m_left * far_side)};
+
+	Vec2f lo = corners[0], hi = corners[0];
+	for(const Vec2f& corner : corners){
+		lo = Vec2f(std::min(lo.x, corner.x), std::min(lo.y, corner.y));
+		hi = Vec2f(std::max(hi.x, corner.x), std::max(hi.y, corner.y));
+	}
+	int x0 = std::clamp(static_cast<int>(floor((lo.x - SPRITE_CULL_PAD) / cell_size)), 0, m_map->w - 1);
+	int y0 = std::clamp(static_cast<int>(floor((lo.y - SPRITE_CULL_PAD) / cell_size)), 0, m_map->h - 1);
+	int x1 = std::clamp(static_cast<int>(floor((hi.x + SPRITE_CULL_PAD) / cell_size)), 0, m_map->w - 1);
+	int y1 = std::clamp(static_cast<int>(floor((hi.y + SPRITE_CULL_PAD) / cell_size)), 0, m_map->h - 1);
+
+	// a grid read from a map file is only checked where it's used.
+	uint32_t count = m_sprite_grid.count;
+	for(int y = y0; y <= y1; y++){
+		for(int x = x0; x <= x1; x++){
+			int cell = y * m_map->w + x;
+			uint32_t end = std::min(m_sprite_grid.cell_start[cell + 1], count);
+			for(uint32_t i = m_sprite_grid.cell_start[cell]; i < end; i++){
+				uint32_t index = m_sprite_grid.sprites[i];
+				if(index >= count || (m_sprites.flags[index] & SPRITE_HIDDEN)) continue;
+
+				Vec2f v = m_sprites.position(index) - p;
+
+				double depth = v.x * m_forward.x + v.y * m_forward.y;
+				if(depth <= 0.0 || depth >= max_depth) continue;
+				if(v.x * left_normal.x + v.y * left_normal.y > margin) continue;
+				if(v.x * right_normal.x + v.y * right_normal.y > margin) continue;
+
+				m_sprite_candidates.push_back(index);
+			}
+		}
+	}
 
-	m_fbuffer.clear();
+	m_sprites.select(m_sprite_candidates.data(), m_sprite_candidates.size());
+	m_sprites.update_distances(p);
+	m_sprites.sort_by_distance();
+
+	size_t passed = 0;
+	for(uint32_t index : m_sprites.order){
+		if(passed == MAX_SPRITES) break;
+
+		// the pvs never changes which sprites are the nearest MAX_SPRITES, it only drops those that draw nothing.
+		passed++;
+		if(m_pvs_set && !pvs_sees_sprite(index)) continue;
+
+		m_visible_sprites.push_back({index, m_sprites.dist[index]});
+	}
+
+	std::reverse(m_visible_sprites.begin(), m_visible_sprites.end());
+}
+
+/*
+ * Whether the pvs lets sprite index show up in any column it is drawn in. Where a column shows
+ * the sprite, its wall is farther away than the sprite, so the column's ray got as far as the
+ * sprite before it stopped and the point it got to is in a cell the player's cell sees. Those
+ * points make an arc around the player from the sprite's first column to its last, the sprite
+ * is kept if its own cell or any cell under the arc's bounding box is in the set. Testing the
+ * cell the sprite stands on alone isn't enough, its columns can look past it into others.
+ * */
+bool rc::Core::pvs_sees_sprite(uint32_t index){
+	uint32_t cell = m_sprites.cell[index];
+	if(m_map->pvs->visible(*m_pvs_set, cell % m_map->w, cell / m_map->w)) return true;
+
+	double dist = m_sprites.dist[index];
+	SDL_Rect dim = sprite_screen_dimensions(sprite_world_2_screen(m_sprites.position(index)).x, dist);
+	int x0 = std::max(0, dim.x);
+	int x1 = std::min(m_proj_plane_w, dim.x + dim.w) - 1;
+	if(x0 > x1) return false;
+
+	// ray angles fall from left to right, see compute_view().
+	const Vec2f& p = m_player->position;
+	double a0 = m_player->viewing_angle + m_constants.half_fov - x1 * m_angle_step;
+	double a1 = m_player->viewing_angle + m_constants.half_fov - x0 * m_angle_step;
+	auto point = [&](double angle){ return Vec2f(p.x + dist * cos(to_rad(angle)), p.y - dist * sin(to_rad(angle))); };
+
+	Vec2f lo = point(a0);
+	Vec2f hi = lo;
+	auto extend = [&](const Vec2f& v){
+		lo = Vec2f(std::min(lo.x, v.x), std::min(lo.y, v.y));
+		hi = Vec2f(std::max(hi.x, v.x), std::max(hi.y, v.y));
+	};
+	extend(point(a1));
+	// the arc bulges past its ends where it crosses an axis.
+	for(double axis = ceil(a0 / 90.0) * 90.0; axis < a1; axis += 90.0){
+		extend(point(axis));
+	}
+
+	double cell_size = m_map->cell_size;
+	int cx0 = std::clamp(static_cast<int>(floor((lo.x - PVS_SPRITE_PAD) / cell_size)), 0, m_map->w - 1);
+	int cy0 = std::clamp(static_cast<int>(floor((lo.y - PVS_SPRITE_PAD) / cell_size)), 0, m_map->h - 1);
+	int cx1 = std::clamp(static_cast<int>(floor((hi.x + PVS_SPRITE_PAD) / cell_size)), 0, m_map->w - 1);
+	int cy1 = std::clamp(static_cast<int>(floor((hi.y + PVS_SPRITE_PAD) / cell_size)), 0, m_map->h - 1);
+	for(int y = cy0; y <= cy1; y++){
+		for(int x = cx0; x <= cx1; x++){
+			if(m_map->pvs->visible(*m_pvs_set, x, y)) return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * The visible sprites are projected once, back to front, then the screen is split into column
+ * bands and every worker draws the whole sorted list clipped to its own bands. Within a column
+ * the draw order is the same as drawing the sprites one after another over the full screen.
+ * */
+void rc::Core::render_sprites(uint32_t flags){
+	assert(m_sprite_grid.count == m_sprites.size());
+	{
+		RC_PROFILE_SCOPE(m_profile[0], PROFILE_SPRITE_SORT);
+		cull_sprites();
+
+		m_projected_sprites.clear();
+		for(const auto& visible : m_visible_sprites){
+			auto screen_coords = sprite_world_2_screen(m_sprites.position(visible.index));
+
+			auto sprite_dim = sprite_screen_dimensions(screen_coords.x, visible.dist);
+			m_projected_sprites.push_back({m_sprites.texture_id[visible.index], sprite_dim, visible.dist});
+		}
+	}
+
+	int jobs = (m_proj_plane_w + COLUMNS_PER_JOB - 1) / COLUMNS_PER_JOB;
+	m_workers->run(jobs, [&](int job, int worker){
+		RC_PROFILE_SCOPE(m_profile[worker], PROFILE_SPRITES);
+		int x0 = job * COLUMNS_PER_JOB;
+		int x1 = std::min(m_proj_plane_w, x0 + COLUMNS_PER_JOB);
+
+		for(const auto& p : m_projected_sprites){
+			if(p.dim.x < x1 && p.dim.x + p.dim.w > x0){
+				draw_sprite(p.texture_id, p.dim, p.dist, x0, x1, flags & TEXTURE_MIPMAPS);
+			}
+		}
+	});
+}
+
+/*
+ * Only the screen columns in [clip_x0, clip_x1) are drawn, so workers can split a sprite by column.
+ * mipmapped reads the level closest to the sprite's size on screen.
+ *
+ * Texture coordinates are stepped in 16.16 fixed point and only the opaque spans of each texture
+ * column are walked: for a span [start, end) the screen rows whose texel lands in it are solved
+ * for directly, so transparent texels are never read and the copy needs no per pixel checks.
+ * */
+void rc::Core::draw_sprite(int texture_id, const SDL_Rect& dim, double dist_from_player, int clip_x0, int clip_x1, bool mipmapped){
+	int start_x = dim.x;
+	int start_y = dim.y;
+	int sprite_w = dim.w;
+
+	if(sprite_w <= 0) return;
+
+	const Texture * texture = m_resources->texture(texture_id);
+	const Mip_level& mip = texture->level(mipmapped ? texture->level_for(texture->w, sprite_w) : 0);
+
+	int64_t step_x = (static_cast<int64_t>(mip.w) << 16) / sprite_w;
+	int64_t step_y = std::max<int64_t>(1, (static_cast<int64_t>(mip.h) << 16) / sprite_w);
+
+	int first_x = std::max(0, clip_x0 - start_x);
+	int last_x = std::min(sprite_w, clip_x1 - start_x);
+
+	// rows of the sprite that are on screen.
+	int64_t first_y = std::max(0, -start_y);
+	int64_t last_y = std::min(dim.h, m_proj_plane_h - start_y);
+
+	auto& fbuffer = *m_fbuffer;
+
+	for(int x = first_x; x < last_x; x++){
+		int screen_x = x + start_x;
+
+		if(!column_in_bounds(screen_x)) continue;
+		if(dist_from_player >= m_wall_dists[screen_x]) continue; // depth test
+
+		int texture_x = (x * step_x) >> 16;
+		uint32_t * column = &fbuffer.pixels[screen_x * fbuffer.x_stride];
+
+		for(uint32_t i = mip.column_spans[texture_x]; i < mip.column_spans[texture_x + 1]; i++){
+			const Texel_span& span = mip.spans[i];
+
+			// first row whose texel is >= start, and the first one past end.
+			int64_t y0 = std::max(first_y, ((static_cast<int64_t>(span.start) << 16) + step_y - 1) / step_y);
+			int64_t y1 = std::min(last_y, ((static_cast<int64_t>(span.end) << 16) + step_y - 1) / step_y);
+
+			const uint32_t * texels = &mip.span_texels[span.texels];
+			int64_t v = y0 * step_y - (static_cast<int64_t>(span.start) << 16);
+			for(int64_t y = y0; y < y1; y++, v += step_y){
+				column[(start_y + y) * fbuffer.y_stride] = texels[v >> 16];
+			}
+		}
+	}
+}
+
+void rc::Core::render_column(int x, const Ray_hit& hit, uint32_t flags){
+	m_hits[x] = hit.point;
+	// store dists to wall for depth testing againts sprite columns
+	m_wall_dists[x] = hit.dist;
+
+	int texture_x = hit.texture_x;
+	const Vec2i& map_coords = hit.cell;
+
+	int slice_height = static_cast<int>(m_constants.cell_size_times_dist / hit.dist);
+
+	assert(map_coords.x >= 0 && map_coords.x < m_map->w && map_coords.y >= 0 && map_coords.y < m_map->h);
+
+	uint32_t cell_data = m_map->at(map_coords.x, map_coords.y);
+	assert(cell_data & WALL_BIT);
+
+	uint32_t cell_index = cell_data >> 8;
+
+	if(flags & DRAW_TEXT_MAPPED_WALLS){
+		const Texture * texture = m_resources->texture(cell_index);
+		if(texture != NULL){
+			draw_textmapped_wall_slice(texture_x, slice_height, x, *texture, flags & TEXTURE_MIPMAPS);
+		}
+	}
+
+	int wall_bot = (slice_height * 0.5f) + m_proj_plane_center;
+	int wall_top = m_proj_plane_center - (slice_height * 0.5f);
+
+	// clip
+	wall_bot = std::min(m_proj_plane_h - 1, wall_bot);
+	wall_top = std::max(0, wall_top);
+
+	if(flags & DRAW_RAW_WALLS){
+		draw_wall_slice(wall_top, wall_bot, x, map_color(m_map->colors[cell_index]));
+	}
+
+	set_floor_column(x, wall_top, wall_bot);
+}
+
+const uint32_t * rc::Core::render(uint32_t flags, int buffer){ 
+	assert(buffer >= 0 && buffer < frame_buffers());
+	m_fbuffer = &m_fbuffers[buffer];
+	if(m_fbuffer->w != m_proj_plane_w || m_fbuffer->h != m_proj_plane_h){
+		m_fbuffer->resize(m_proj_plane_w, m_proj_plane_h);
+	}
+	m_fbuffer->set_layout(flags & TARGET_COLUMN_MAJOR);
+	// textures added since the last frame go into the atlas before any worker samples it.
+	m_resources->build_atlas();
+	reset_arena();
+#ifdef RC_PROFILE
+	for(auto& times : m_profile) times.clear();
+#endif
+
+	Layer_key key = {m_player->position, m_player->viewing_angle, m_map_version, flags};
+	bool still = key == m_last_key;
+	m_last_key = key;
+
+	if(!(flags & LAYERED_SCENE)){
+		render_scene(flags);
+		render_sprites(flags);
+	}else if(m_layer.serial != 0 && m_layer.key == key){
+		compose_layer(flags);
+	}else{
+		render_scene(flags);
+		m_fbuffer->layer = 0;
+
+		// the camera stopped, what it sees is kept for the frames after this one.
+		if(still) cache_layer();
+
+		render_sprites(flags);
+		keep_sprite_rects();
+	}
+
+	// a target is only ours until it's handed back, what's left in it next time isn't known.
+	if(m_fbuffer->pixels == m_fbuffer->target) m_fbuffer->layer = 0;
+
+#ifdef RC_PROFILE
+	m_fbuffer->profile.clear();
+	for(const auto& times : m_profile) m_fbuffer->profile += times;
+#endif
+	return m_fbuffer->pixels;
+}
+
+/* The lists are given up before the memory under them is, their deallocate() is a no-op.*/
+void rc::Core::reset_arena(){
+	m_visible_sprites = Arena_vector<Visible_sprite>(Arena_allocator<Visible_sprite>(m_arena));
+	m_sprite_candidates = Arena_vector<uint32_t>(Arena_allocator<uint32_t>(m_arena));
+	m_projected_sprites = Arena_vector<Projected_sprite>(Arena_allocator<Projected_sprite>(m_arena));
+	m_arena.reset();
+
+	m_projected_sprites.reserve(MAX_SPRITES);
+}
+
+/*
+ * Columns only ever write their own framebuffer column and their own m_hits/m_wall_dists
+ * entry, so they are traced in parallel in bands of COLUMNS_PER_JOB. Floor and ceiling rows
+ * are split the same way in bands of ROWS_PER_JOB once all the columns are done. The ray
+ * angles are stepped serially first, the same way a single loop would, so the output doesn't
+ * depend on the number of threads.
+ * */
+void rc::Core::render_scene(uint32_t flags){
+	m_fbuffer->clear();
 
 	std::fill(m_hits.begin(), m_hits.end(), Vec2f(0, 0));
 	std::fill(m_wall_dists.begin(), m_wall_dists.end(), 0.0);
 
-	memset(visited_cell, 0, sizeof(bool) * MAP_MAX_SIZE * MAP_MAX_SIZE);
+	clear_visited();
+	compute_view();
+	find_pvs_set(flags);
 
-	Vec2i map_coords_h, map_coords_v;
-	Vec2f h_hit, v_hit;
+	// columns [reuse_x0, reuse_x1) look along a ray of the last frame, see reproject_turn().
+	int turn = reproject_turn(flags);
+	int reuse_x0 = turn == INT_MAX ? 0 : std::max(0, turn);
+	int reuse_x1 = turn == INT_MAX ? 0 : std::min(m_proj_plane_w, m_proj_plane_w + turn);
+	const std::vector<Ray_hit>& last_rays = m_rays.hits[m_rays.last];
+	std::vector<Ray_hit>& rays = m_rays.hits[m_rays.last ^ 1];
 
 	/*Trace a ray for every colum*/
-	for(int x = 0; x < m_proj_plane_w; x++){
-		if(ray_angle > 360.0) ray_angle -= 360.0;
-		if(ray_angle < 0.0) ray_angle += 360.0;
+	// the job goes to run() by reference, a std::function made from a lambda this big would allocate.
+	int jobs = (m_proj_plane_w + COLUMNS_PER_JOB - 1) / COLUMNS_PER_JOB;
+	auto trace_columns = [&](int job, int worker){
+		int start = job * COLUMNS_PER_JOB;
+		int end = std::min(m_proj_plane_w, start + COLUMNS_PER_JOB);
+
+		Ray_hit hits[COLUMNS_PER_JOB];
+		{
+			RC_PROFILE_SCOPE(m_profile[worker], PROFILE_TRAVERSAL);
+			int x0 = std::clamp(reuse_x0, start, end);
+			int x1 = std::clamp(reuse_x1, x0, end);
+			cast_rays(start, x0, flags, hits, worker);
+			for(int x = x0; x < x1; x++){
+				if(!reproject_ray(x, flags, last_rays[x - turn], hits[x - start])){
+					cast_rays(x, x + 1, flags, &hits[x - start], worker);
+				}
+			}
+			cast_rays(x1, end, flags, &hits[x1 - start], worker);
+		}
 
-		assert(ray_angle >= 0 && ray_angle <= 360.0);
+		{
+			RC_PROFILE_SCOPE(m_profile[worker], PROFILE_WALLS);
+			for(int x = start; x < end; x++){
+				render_column(x, hits[x - start], flags);
+			}
+		}
 
-		double h_dist = find_h_intercept(ray_angle, h_hit, map_coords_h);
-		double v_dist = find_v_intercept(ray_angle, v_hit, map_coords_v);
+		if(flags & REPROJECT_ROTATION){
+			std::copy(hits, hits + (end - start), &rays[start]);
+		}
 
-		m_hits[x] = h_dist < v_dist ? h_hit: v_hit;
-		// store dists to wall for depth testing againts sprite columns
-		m_wall_dists[x] = std::min(h_dist, v_dist);
+		// column major, the floor and ceiling of a column are contiguous too.
+		if(flags & TARGET_COLUMN_MAJOR){
+			for(int x = start; x < end; x++){
+				{
+					RC_PROFILE_SCOPE(m_profile[worker], PROFILE_CEILING);
+					draw_ceiling_column(x, flags);
+				}
+				RC_PROFILE_SCOPE(m_profile[worker], PROFILE_FLOOR);
+				draw_floor_column(x, flags);
+			}
+		}
+	};
+	m_workers->run(jobs, std::ref(trace_columns));
+
+	if(flags & REPROJECT_ROTATION){
+		m_rays.last ^= 1;
+		m_rays.position = m_player->position;
+		m_rays.viewing_angle = m_player->viewing_angle;
+		m_rays.map_version = m_map_version;
+		m_rays.valid = true;
+	}else{
+		m_rays.valid = false;
+	}
 
-		int texture_x = h_dist < v_dist ? static_cast<int>(h_hit.x) % 64 : static_cast<int>(v_hit.y) % 64;
-		
-		auto& map_coords = h_dist < v_dist ? map_coords_h : map_coords_v;
+	/*Floor and ceiling, a row at a time once every column knows where its wall is*/
+	if(!(flags & TARGET_COLUMN_MAJOR)){
+		jobs = (m_proj_plane_h + ROWS_PER_JOB - 1) / ROWS_PER_JOB;
+		m_workers->run(jobs, [&](int job, int worker){
+			int y0 = job * ROWS_PER_JOB;
+			int y1 = std::min(m_proj_plane_h, y0 + ROWS_PER_JOB);
+			int horizon = std::clamp(m_proj_plane_center + 1, y0, y1);
+			{
+				RC_PROFILE_SCOPE(m_profile[worker], PROFILE_CEILING);
+				draw_floor_ceiling_rows(y0, horizon, flags);
+			}
+			RC_PROFILE_SCOPE(m_profile[worker], PROFILE_FLOOR);
+			draw_floor_ceiling_rows(horizon, y1, flags);
+		});
+	}
+}
 
-		double dist_to_wall = std::min(h_dist, v_dist);
-		int slice_height = static_cast<int>(m_constants.cell_size_times_dist / dist_to_wall);
+/*
+ * Under REPROJECT_ROTATION, how many columns the view turned left since the last frame's rays
+ * if it only turned, by a whole number of columns: column x then looks along the same world
+ * ray as the last frame's column x - turn. INT_MAX when the rays can't be reused, the player
+ * moved, the map changed or the turn falls between columns.
+ * */
+int rc::Core::reproject_turn(uint32_t flags) const {
+	if(!(flags & REPROJECT_ROTATION) || !m_rays.valid || m_rays.map_version != m_map_version) return INT_MAX;
+	if(m_rays.position.x != m_player->position.x || m_rays.position.y != m_player->position.y) return INT_MAX;
 
-		assert(map_coords.x >= 0 && map_coords.x < m_map->w && map_coords.y >= 0 && map_coords.y < m_map->h);
+	double columns = remainder(m_player->viewing_angle - m_rays.viewing_angle, 360.0) / m_angle_step;
+	double whole = round(columns);
+	if(fabs(columns - whole) > REPROJECT_TOLERANCE || fabs(whole) >= m_proj_plane_w) return INT_MAX;
 
-		uint32_t cell_data = m_map->at(map_coords.x, map_coords.y);
-		assert(cell_data & WALL_BIT);
+	return static_cast<int>(whole);
+}
 
-		uint32_t cell_index = cell_data >> 8;
-		uint32_t color = m_map->colors[cell_index];
+/*
+ * Same cell, point and texture column, only the fisheye corrected distance changes with the
+ * view. The old ray's direction is the new one's only up to rounding, which doesn't matter
+ * unless the ray is right on an edge: a hit on a texel boundary, where the texture column may
+ * flip, a ray along a grid axis, which the intercept walks treat on their own, or a slice right
+ * between two heights. Those are traced again, it's false then.
+ * */
+bool rc::Core::reproject_ray(int x, uint32_t flags, const Ray_hit& last, Ray_hit& hit) const {
+	if(fabs(remainder(m_ray_angles[x], 90.0)) < REPROJECT_EDGE) return false;
 
-		if(flags & DRAW_TEXT_MAPPED_WALLS){
-			SDL_Surface * texture = m_resources->get_surface(cell_index);
-			if(texture != NULL){
-				draw_textmapped_wall_slice(texture_x, slice_height, x, texture);
-			}
+	hit = last;
+	if(hit.dist == DBL_MAX) return true;
+
+	if(fabs(hit.point.x - round(hit.point.x)) < REPROJECT_EDGE || fabs(hit.point.y - round(hit.point.y)) < REPROJECT_EDGE){
+		// a hit is always on a grid line along one axis, it only matters on the face's own.
+		bool vertical_face = fabs(remainder(hit.point.x, m_map->cell_size)) < REPROJECT_EDGE;
+		double face = vertical_face ? hit.point.y : hit.point.x;
+		if(fabs(face - round(face)) < REPROJECT_EDGE) return false;
+	}
+
+	// the way the traversal that traced the column would have corrected it.
+	Vec2f v = hit.point - m_player->position;
+	if(flags & (TRAVERSAL_DDA | TRAVERSAL_PACKET)){
+		hit.dist = v.length() * m_column_dirs[x].x;
+	}else{
+		hit.dist = v.x * m_forward.x + v.y * m_forward.y;
+	}
+
+	// and a slice height that lands on a whole number of rows could round either way.
+	double slice_height = m_constants.cell_size_times_dist / hit.dist;
+	return fabs(slice_height - round(slice_height)) >= REPROJECT_EDGE;
+}
+
+/* Copies the scene just rendered into m_fbuffer, before any sprite is drawn over it.*/
+void rc::Core::cache_layer(){
+	const Frame_buffer& fbuffer = *m_fbuffer;
+
+	m_layer.pixels.resize(static_cast<size_t>(m_proj_plane_w) * m_proj_plane_h);
+	if(fbuffer.column_major || fbuffer.y_stride == m_proj_plane_w){
+		std::copy(fbuffer.pixels, fbuffer.pixels + m_layer.pixels.size(), m_layer.pixels.begin());
+	}else{
+		for(int y = 0; y < m_proj_plane_h; y++){
+			memcpy(&m_layer.pixels[y * m_proj_plane_w], fbuffer.pixels + y * fbuffer.y_stride, m_proj_plane_w * sizeof(uint32_t));
 		}
+	}
 
-        int wall_bot = (slice_height * 0.5f) + m_proj_plane_center;
-	    int wall_top = m_proj_plane_center - (slice_height * 0.5f);
+	m_layer.wall_dists = m_wall_dists;
+	m_layer.hits = m_hits;
+	m_layer.key = m_last_key;
+	m_layer.serial = ++m_layer_serial;
+	m_fbuffer->layer = m_layer.serial;
+}
 
-		// clip
-		wall_bot = std::min(m_proj_plane_h - 1, wall_bot);
-		wall_top = std::max(0, wall_top);
+/*
+ * The frame of a camera that hasn't moved since m_layer was taken: the cached scene and its
+ * depth are put back and the sprites are drawn over them again. A framebuffer that still holds
+ * the layer only gets the rects its last sprites covered restored, and if the sprites haven't
+ * changed either it already holds this very frame.
+ * */
+void rc::Core::compose_layer(uint32_t flags){
+	Frame_buffer& fbuffer = *m_fbuffer;
+
+	std::copy(m_layer.wall_dists.begin(), m_layer.wall_dists.end(), m_wall_dists.begin());
+	std::copy(m_layer.hits.begin(), m_layer.hits.end(), m_hits.begin());
+	compute_view();
+	find_pvs_set(flags);
 
-		if(flags & DRAW_RAW_WALLS){
-			draw_wall_slice(wall_top, wall_bot, x, color);
+	if(fbuffer.layer == m_layer.serial){
+		if(fbuffer.sprites == m_sprite_version) return;
+
+		for(const auto& rect : fbuffer.sprite_rects){
+			restore_rect(rect);
 		}
+	}else{
+		restore_rect({0, 0, m_proj_plane_w, m_proj_plane_h});
+		fbuffer.layer = m_layer.serial;
+	}
 
-		draw_floor_slice(ray_angle, x, wall_bot);
-		draw_celing_slice(ray_angle, x, wall_top);
+	render_sprites(flags);
+	keep_sprite_rects();
+}
 
-		ray_angle -= m_angle_step;
+/* Copies the part of m_layer under rect, already clipped to the plane, back into m_fbuffer.*/
+void rc::Core::restore_rect(const SDL_Rect& rect){
+	const Frame_buffer& fbuffer = *m_fbuffer;
+
+	if(fbuffer.column_major){
+		for(int x = rect.x; x < rect.x + rect.w; x++){
+			const uint32_t * src = &m_layer.pixels[x * m_proj_plane_h + rect.y];
+			std::copy(src, src + rect.h, fbuffer.pixels + x * fbuffer.x_stride + rect.y);
+		}
+		return;
 	}
 
-	render_sprites();
+	for(int y = rect.y; y < rect.y + rect.h; y++){
+		const uint32_t * src = &m_layer.pixels[y * m_proj_plane_w + rect.x];
+		std::copy(src, src + rect.w, fbuffer.pixels + y * fbuffer.y_stride + rect.x);
+	}
+}
+
+/* Where render_sprites() drew over the scene, clipped to the plane, for compose_layer() to undo.*/
+void rc::Core::keep_sprite_rects(){
+	Frame_buffer& fbuffer = *m_fbuffer;
+	fbuffer.sprite_rects.clear();
+	fbuffer.sprites = m_sprite_version;
+
+	for(const auto& p : m_projected_sprites){
+		int x0 = std::max(0, p.dim.x);
+		int y0 = std::max(0, p.dim.y);
+		int x1 = std::min(m_proj_plane_w, p.dim.x + p.dim.w);
+		int y1 = std::min(m_proj_plane_h, p.dim.y + p.dim.h);
+		if(x0 < x1 && y0 < y1) fbuffer.sprite_rects.push_back({x0, y0, x1 - x0, y1 - y0});
+	}
+}
+
+/*
+ * Copies the frame last rendered into buffer to dst row major, pitch is in bytes, at the plane
+ * size it was rendered at. A column major frame is transposed on the way, so it's the only
+ * place that pays for the layout.
+ * */
+void rc::Core::copy_frame(uint32_t * dst, int pitch, int buffer) const {
+	const Frame_buffer& fbuffer = m_fbuffers[buffer];
+	size_t dst_stride = pitch / sizeof(uint32_t);
+
+	if(fbuffer.column_major){
+		transpose_pixels(&fbuffer.pixels[0], fbuffer.h, dst, dst_stride, fbuffer.w, fbuffer.h);
+		return;
+	}
+
+	for(int y = 0; y < fbuffer.h; y++){
+		memcpy(dst + y * dst_stride, &fbuffer.pixels[y * fbuffer.y_stride], fbuffer.w * sizeof(uint32_t));
+	}
+}
+
+/* Not while a frame is being rendered or copied out, the buffers are reallocated.*/
+void rc::Core::set_frame_buffers(int count){
+	assert(count >= 1 && count <= MAX_FRAME_BUFFERS);
+	m_fbuffers.clear();
+	for(int i = 0; i < count; i++){
+		m_fbuffers.emplace_back(m_proj_plane_w, m_proj_plane_h);
+	}
+	m_fbuffer = &m_fbuffers[0];
+}
+
+/* Takes effect from the next render() into buffer.*/
+void rc::Core::set_frame_target(int buffer, uint32_t * pixels, int pitch){
+	assert(buffer >= 0 && buffer < frame_buffers());
+	assert(!pixels || (pitch % sizeof(uint32_t) == 0 && pitch >= static_cast<int>(m_proj_plane_w * sizeof(uint32_t))));
+	m_fbuffers[buffer].target = pixels;
+	m_fbuffers[buffer].target_pitch = pitch / sizeof(uint32_t);
+	m_fbuffers[buffer].layer = 0;
+}
+
+void rc::Core::set_pixel_format(uint32_t format){
+	map_changed();
+	sprites_changed();
+	if(m_pixel_format) SDL_FreeFormat(m_pixel_format);
+	m_pixel_format = NULL;
+	if(format == SDL_PIXELFORMAT_RGBA8888) return;
+
+	RC_DIE(!(m_pixel_format = SDL_AllocFormat(format)), SDL_GetError());
+	RC_DIE(m_pixel_format->BytesPerPixel != sizeof(uint32_t), "the framebuffer needs a 32 bit pixel format");
+}
 
-	return &m_fbuffer.pixels[0];
+uint32_t rc::Core::map_color(uint32_t rgba) const {
+	if(!m_pixel_format) return rgba;
+	return SDL_MapRGBA(m_pixel_format, rgba >> 24, (rgba >> 16) & 0xff, (rgba >> 8) & 0xff, rgba & 0xff);
 }
@@ -1,5 +1,7 @@
 #include "RC_Engine.h"
 #include "RC_Core.h"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
 #include "map.h"
@@ -15,7 +17,6 @@ uint32_t temp_map[8 * 8] = {
 	WALL(1), WALL(1)   , WALL(1)   , WALL(1)   , WALL(1)   , WALL(1)   , WALL(1)   , WALL(1),
 };
 
-#define TARGET_FPS 60
 static const double target_time_per_frame = 1.0 / TARGET_FPS;
 SDL_Texture * sprite_texture;
 
@@ -24,6 +25,9 @@ rc::Engine::Engine(int w, int h) : Core(PROJ_PLANE_W, PROJ_PLANE_H, 60.0){
 }
 
 rc::Engine::~Engine(){
+	for(int i = 0; i < MAX_FRAME_BUFFERS; i++){
+		SDL_DestroyTexture(m_frame_textures[i]);
+	}
 	SDL_DestroyRenderer(m_renderer);
 	SDL_DestroyWindow(m_window);
 	SDL_Quit();
@@ -35,13 +39,14 @@ void rc::Engine::init_viewports(){
 }
 
 void rc::Engine::load_textures(){
-	m_resources->add_surface(FLOOR_TEXT, load_surface_RGBA(m_renderer, "./assets/floor.png"));
-	m_resources->add_surface(SPACE_WALL_TEXT, load_surface_RGBA(m_renderer, "./assets/space_wall.png"));
-	m_resources->add_surface(WOLF_WALL_TEXT, load_surface_RGBA(m_renderer, "./assets/wall.png"));
+	m_resources->add_surface(FLOOR_TEXT, load_surface("./assets/floor.png", m_texture_format));
+	m_resources->add_surface(SPACE_WALL_TEXT, load_surface("./assets/space_wall.png", m_texture_format));
+	m_resources->add_surface(WOLF_WALL_TEXT, load_surface("./assets/wall.png", m_texture_format));
 	m_resources->add_surface(CEILING_TEXT, m_resources->get_surface(WOLF_WALL_TEXT));
-	m_resources->add_surface(BARREL_SPRITE, load_surface_RGBA(m_renderer, "./assets/barrel.png", 0x980088ff));
-	m_resources->add_surface(ENEMY_SPRITE, load_surface_RGBA(m_renderer, "./assets/enemy.png"));
-	m_resources->add_surface(DOOM_SPRITE, load_surface_RGBA(m_renderer, "./assets/doom_guy.png", 0xa76b6bff));
+	m_resources->add_surface(BARREL_SPRITE, load_surface("./assets/barrel.png", m_texture_format, 0x980088ff));
+	m_resources->add_surface(ENEMY_SPRITE, load_surface("./assets/enemy.png", m_texture_format));
+	m_resources->add_surface(DOOM_SPRITE, load_surface("./assets/doom_guy.png", m_texture_format, 0xa76b6bff));
+	m_resources->build_atlas();
 }
 
 void rc::Engine::init(int w, int h){
@@ -76,24 +81,124 @@ void rc::Engine::init(int w, int h){
 	
 	time.prev_time = SDL_GetPerformanceCounter();
 	time.frequency = SDL_GetPerformanceFrequency();
-	time.delta_time = 0;
+	time.delta_time = 1.0 / SIM_HZ;
+	time.deadline = time.prev_time;
+	time.accumulator = 0.0;
+	memset(&pacing, 0, sizeof(pacing));
 
 	m_window = window;
 	m_renderer = renderer;
 	m_running = true;
 
 	init_viewports();
+
+	// textures, and so the frames sampled from them, are kept in the format the renderer streams without converting.
+	m_texture_format = native_pixel_format(m_renderer);
+	set_pixel_format(m_texture_format);
 	load_textures();
-		
-	// initialize frame buffer to copy pixels from core
-	RC_DIE(!(m_fbuffer_texture = SDL_CreateTexture(m_renderer,
-								 SDL_PIXELFORMAT_RGBA8888,
-								 SDL_TEXTUREACCESS_STREAMING,
-							     PROJ_PLANE_W,
-							     PROJ_PLANE_H)), SDL_GetError());
 
+	// RC_MAP=path plays a map file written by map_convert instead of the built in map.
+	const char * map_file = getenv("RC_MAP");
+	if(map_file != NULL){
+		load_map(load_map_file(map_file));
+	}
+
+	// render worker count, defaults to one per hardware thread.
+	const char * threads = getenv("RC_THREADS");
+	if(threads != NULL && atoi(threads) > 0){
+		set_threads(atoi(threads));
+	}
+
+	/* RC_TRAVERSAL=dda walks the grid once per column instead of the two intercept walks,
+	 * RC_TRAVERSAL=packet does the same walk for several columns at once with simd.*/
+	m_render_flags = DRAW_TEXT_MAPPED_WALLS;
+	const char * traversal = getenv("RC_TRAVERSAL");
+	if(traversal != NULL && !strcmp(traversal, "dda")){
+		m_render_flags |= TRAVERSAL_DDA;
+	}else if(traversal != NULL && !strcmp(traversal, "packet")){
+		m_render_flags |= TRAVERSAL_PACKET;
+	}
+
+	// RC_LAYOUT=column renders into a column major framebuffer, transposed when it's presented.
+	const char * layout = getenv("RC_LAYOUT");
+	if(layout != NULL && !strcmp(layout, "column")){
+		m_render_flags |= TARGET_COLUMN_MAJOR;
+	}
+
+	/* RC_FRAME_QUEUE=n renders up to n frames ahead of the one on screen on a render thread,
+	 * a frame of latency each. 1 by default, double buffered, 0 renders and presents in turn.*/
+	m_frame_queue = 1;
+	const char * frame_queue = getenv("RC_FRAME_QUEUE");
+	if(frame_queue != NULL){
+		m_frame_queue = std::clamp(atoi(frame_queue), 0, MAX_FRAME_BUFFERS - 1);
+	}
+	static_assert(FRAME_RING_SIZE >= MAX_FRAME_BUFFERS + 1, "a ring has to hold every buffer and the stop message");
+	set_frame_buffers(m_frame_queue + 1);
+	for(int i = m_frame_queue; i >= 0; i--){
+		m_free_buffers.push_back(i);
+	}
+	m_sim_player = *m_player;
+	m_prev_player = m_sim_player;
+
+	// mipmapped textures unless RC_MIPMAPS=0, that gives the raw nearest texel everywhere.
+	const char * mipmaps = getenv("RC_MIPMAPS");
+	if(mipmaps == NULL || strcmp(mipmaps, "0")){
+		m_render_flags |= TEXTURE_MIPMAPS;
+	}
+
+	// the map's potentially visible sets bound sprite culling unless RC_PVS=0, no-op without them.
+	const char * pvs = getenv("RC_PVS");
+	if(pvs == NULL || strcmp(pvs, "0")){
+		m_render_flags |= VISIBILITY_PVS;
+	}
+
+	/* The scene a still camera sees is kept and only the sprites are redrawn, and nothing at all
+	 * is rendered while nothing changes, unless RC_LAYERS=0.*/
+	const char * layers = getenv("RC_LAYERS");
+	if(layers == NULL || strcmp(layers, "0")){
+		m_render_flags |= LAYERED_SCENE;
+	}
+	m_redraw = true;
 
+	// a camera that only turned reuses the rays of the columns it still sees unless RC_REPROJECT=0.
+	const char * reproject = getenv("RC_REPROJECT");
+	if(reproject == NULL || strcmp(reproject, "0")){
+		m_render_flags |= REPROJECT_ROTATION;
+	}
+		
+	for(int i = 0; i < MAX_FRAME_BUFFERS; i++){
+		m_frame_textures[i] = NULL;
+		create_frame_texture(i, PROJ_PLANE_W, PROJ_PLANE_H);
+	}
 
+	/* RC_FRAME_MS=t lowers the resolution frames are rendered at while they take longer than t
+	 * ms, a frame's worth by default, and raises it back when they're faster. 0 keeps it full.*/
+	m_resolution.target_ms = target_time_per_frame * 1000.0;
+	const char * frame_ms = getenv("RC_FRAME_MS");
+	if(frame_ms != NULL){
+		m_resolution.target_ms = std::max(atof(frame_ms), 0.0);
+	}
+	m_resolution.average_ms = m_resolution.target_ms;
+	m_resolution.scale = 1.0;
+	m_resolution.w = PROJ_PLANE_W;
+	m_resolution.h = PROJ_PLANE_H;
+
+	/* Row major frames are rendered into the locked texture unless RC_ZERO_COPY=0, that renders
+	 * into Core's framebuffer and uploads it. A column major one is always transposed into it.*/
+	const char * zero_copy = getenv("RC_ZERO_COPY");
+	m_zero_copy = !(m_render_flags & TARGET_COLUMN_MAJOR) && (zero_copy == NULL || strcmp(zero_copy, "0"));
+
+#ifdef RC_PROFILE
+	/* RC_PROFILE_OUT=path writes every frame's stage times to path, a Chrome trace if it ends in
+	 * .json, CSV otherwise. RC_PROFILE_OVERLAY=1 draws their percentiles over the frame.*/
+	m_profile.clear();
+	const char * profile_out = getenv("RC_PROFILE_OUT");
+	if(profile_out != NULL){
+		m_profiler.open(profile_out);
+	}
+	const char * profile_overlay = getenv("RC_PROFILE_OVERLAY");
+	m_profile_overlay = profile_overlay != NULL && strcmp(profile_overlay, "0");
+#endif
 
 	RC_DIE(!(sprite_texture = SDL_CreateTexture(m_renderer, 
 							                    SDL_PIXELFORMAT_RGBA8888, 
@@ -104,6 +209,18 @@ void rc::Engine::init(int w, int h){
 	SDL_SetTextureBlendMode(sprite_texture, SDL_BLENDMODE_BLEND);
 }
 
+/* A buffer's texture is always the size of the frame in it, SDL_RenderCopy scales it to the window.*/
+void rc::Engine::create_frame_texture(int buffer, int w, int h){
+	if(m_frame_textures[buffer]) SDL_DestroyTexture(m_frame_textures[buffer]);
+	RC_DIE(!(m_frame_textures[buffer] = SDL_CreateTexture(m_renderer,
+										m_texture_format,
+										SDL_TEXTUREACCESS_STREAMING,
+										w,
+										h)), SDL_GetError());
+	m_frames[buffer].w = w;
+	m_frames[buffer].h = h;
+}
+
 void rc::Engine::do_keyup(const SDL_KeyboardEvent * e){
 	if (e->repeat == 0 && e->keysym.scancode < KEYBOARD_MAX_KEYS){
 		input.keyboard[e->keysym.scancode] = false;
@@ -125,6 +242,7 @@ void rc::Engine::do_input(){
 				break;
 			case SDL_KEYDOWN: do_keydown(&e.key); break;
 			case SDL_KEYUP: do_keyup(&e.key); break;
+			case SDL_WINDOWEVENT: m_redraw = true; break;
 			default:
 				break;
 		}
@@ -138,34 +256,246 @@ void rc::Engine::prepare_scene(){
 	RC_DIE(SDL_RenderClear(m_renderer) < 0, SDL_GetError());
 }
 
-void rc::Engine::cap_fps(){
-// cap fps to 60 fps
-	uint64_t curr_time = SDL_GetPerformanceCounter();
-	double time_diff = (double)((curr_time - time.prev_time));
-	time.delta_time =  time_diff / time.frequency;
+/*
+ * Sleeps until time.deadline and moves it a frame on. SDL_Delay() only takes whole ms and may
+ * wake up late, so a precise wait sleeps until SPIN_MS before the deadline and spins the rest on
+ * the performance counter. Nothing is presented after an imprecise one, it only sleeps. A loop
+ * that got there more than a frame late counts the frames it missed and starts over from now
+ * rather than rushing frames out to catch up.
+ * */
+void rc::Engine::wait_frame(bool precise){
+	uint64_t frame = static_cast<uint64_t>(target_time_per_frame * time.frequency);
+	uint64_t spin = precise ? static_cast<uint64_t>(SPIN_MS * 0.001 * time.frequency) : 0;
+	uint64_t now = SDL_GetPerformanceCounter();
+
+	if(now + spin < time.deadline){
+		double sleep_ms = (time.deadline - spin - now) * 1000.0 / time.frequency;
+		SDL_Delay(static_cast<uint32_t>(precise ? sleep_ms : ceil(sleep_ms)));
+	}
+	if(precise){
+		while((now = SDL_GetPerformanceCounter()) < time.deadline);
+	}else{
+		now = std::max(SDL_GetPerformanceCounter(), time.deadline);
+	}
+
+	double late_ms = (now - time.deadline) * 1000.0 / time.frequency;
+	pacing.frames++;
+	pacing.max_late_ms = std::max(pacing.max_late_ms, late_ms);
+	pacing.total_late_ms += late_ms;
+
+	if(now - time.deadline >= frame){
+		pacing.missed += (now - time.deadline) / frame;
+		time.deadline = now;
+	}
+	time.deadline += frame;
+}
+
+/* Runs update() in fixed steps of time.delta_time for the time gone by since the last call.*/
+void rc::Engine::step_simulation(){
+	uint64_t now = SDL_GetPerformanceCounter();
+	time.accumulator += static_cast<double>(now - time.prev_time) / time.frequency;
+	time.prev_time = now;
 
-	if(time.delta_time < target_time_per_frame){
-		double sleep_time = (target_time_per_frame - time.delta_time) * 1000.0;
-		SDL_Delay(sleep_time);
+	time.accumulator = std::min(time.accumulator, MAX_SIM_STEPS * time.delta_time);
+	for(; time.accumulator >= time.delta_time; time.accumulator -= time.delta_time){
+		m_prev_player = m_sim_player;
+		update();
 	}
+}
 
-	time.prev_time = curr_time;
+/*
+ * The camera time.accumulator into the step from m_prev_player to m_sim_player. The turn is
+ * rounded to whole columns like the player's own turns are, see Player::update().
+ * */
+void rc::Engine::interpolate_view(){
+	double t = time.accumulator / time.delta_time;
+	m_view_position = m_prev_player.position + (m_sim_player.position - m_prev_player.position) * t;
+
+	double columns = remainder(m_sim_player.viewing_angle - m_prev_player.viewing_angle, 360.0) / m_sim_player.column_angle;
+	m_view_angle = m_prev_player.viewing_angle + round(columns * t) * m_sim_player.column_angle;
+	if(m_view_angle > 360.0) m_view_angle -= 360.0;
+	if(m_view_angle < 0.0) m_view_angle += 360.0;
 }
 
 void rc::Engine::run(){
+	int queued = 0; // frames submitted and not presented yet.
+
+	if(m_frame_queue > 0){
+		m_render_thread = std::thread(&Engine::render_loop, this);
+	}
+
+	bool idle = false; // nothing was submitted last time round, nothing waits to be presented on time.
+	time.prev_time = time.deadline = SDL_GetPerformanceCounter();
+
 	while(m_running){
-		do_input();
+		wait_frame(!idle);
 
-		cap_fps();
+		// input is read after the wait, as close to rendering the frame it steers as it gets.
+		{
+			RC_PROFILE_SCOPE(m_profile, PROFILE_INPUT);
+			do_input();
+		}
 
-		prepare_scene();
+		{
+			RC_PROFILE_SCOPE(m_profile, PROFILE_UPDATE);
+			step_simulation();
+			interpolate_view();
+		}
 
-		update();
+		// the frame on screen is still right, the ones in flight are shown and no new one is rendered.
+		idle = (m_render_flags & LAYERED_SCENE) && !frame_changed();
+		if(idle){
+			for(; queued > 0; queued--){
+				present_frame();
+			}
+			continue;
+		}
+
+		submit_frame();
+		queued++;
+
+		// the oldest frames go on screen until at most m_frame_queue are left ahead.
+		for(; queued > m_frame_queue; queued--){
+			present_frame();
+		}
+	}
 
-		draw();
+	if(m_render_thread.joinable()){
+		m_to_render.push(-1);
+		m_render_thread.join();
+	}
+
+#ifdef RC_PROFILE
+	if(m_profiler.frames() > 0) m_profiler.print(stderr);
+	fprintf(stderr, "%llu frames, %llu missed, woke up %.3f ms late on average, %.3f at worst\n",
+			static_cast<unsigned long long>(pacing.frames), static_cast<unsigned long long>(pacing.missed),
+			pacing.frames ? pacing.total_late_ms / pacing.frames : 0.0, pacing.max_late_ms);
+#endif
+}
+
+bool rc::Engine::frame_changed() const {
+	return m_redraw || scene_version() != m_last_scene ||
+		   m_resolution.w != m_last_frame.w || m_resolution.h != m_last_frame.h ||
+		   m_view_position.x != m_last_frame.position.x || m_view_position.y != m_last_frame.position.y ||
+		   m_view_angle != m_last_frame.viewing_angle;
+}
+
+void rc::Engine::submit_frame(){
+	// at most m_frame_queue frames are out after presenting, one buffer is always free.
+	int buffer = m_free_buffers.back();
+	m_free_buffers.pop_back();
+
+	// the buffer isn't in flight, its texture can be swapped for one of the new size.
+	Frame& frame = m_frames[buffer];
+	if(frame.w != m_resolution.w || frame.h != m_resolution.h){
+		create_frame_texture(buffer, m_resolution.w, m_resolution.h);
+	}
+	frame.position = m_view_position;
+	frame.viewing_angle = m_view_angle;
+	frame.target = NULL;
+#ifdef RC_PROFILE
+	frame.profile = m_profile;
+	m_profile.clear();
+#endif
+
+	m_last_frame = frame;
+	m_last_scene = scene_version();
+	m_redraw = false;
+
+	// SDL's renderer belongs to the main thread, the render thread gets the memory already locked.
+	if(m_zero_copy){
+		void * pixels;
+		RC_DIE(SDL_LockTexture(m_frame_textures[buffer], NULL, &pixels, &frame.pitch) < 0, SDL_GetError());
+		frame.target = static_cast<uint32_t *>(pixels);
+	}
+
+	if(m_frame_queue > 0){
+		m_to_render.push(buffer);
+	}else{
+		render_frame(buffer);
+		m_to_present.push(buffer);
+	}
+}
 
+void rc::Engine::render_frame(int buffer){
+	Frame& frame = m_frames[buffer];
+	uint64_t start = SDL_GetPerformanceCounter();
+
+	if(frame.w != plane_w() || frame.h != plane_h()){
+		set_plane_size(frame.w, frame.h);
+	}
+	m_player->position = frame.position;
+	m_player->viewing_angle = frame.viewing_angle;
+	set_frame_target(buffer, frame.target, frame.pitch);
+	frame.pixels = render(m_render_flags, buffer);
+
+	frame.render_ms = (SDL_GetPerformanceCounter() - start) * 1000.0 / time.frequency;
+}
+
+void rc::Engine::render_loop(){
+	for(int buffer = m_to_render.pop(); buffer >= 0; buffer = m_to_render.pop()){
+		render_frame(buffer);
+		m_to_present.push(buffer);
+	}
+}
+
+/* Waits for the oldest frame if it's still being rendered.*/
+void rc::Engine::present_frame(){
+	int buffer = m_to_present.pop();
+#ifdef RC_PROFILE
+	m_frames[buffer].profile += frame_profile(buffer);
+#endif
+
+	prepare_scene();
+	draw(buffer);
+#ifdef RC_PROFILE
+	if(m_profile_overlay) draw_profile();
+#endif
+	{
+		RC_PROFILE_SCOPE(m_frames[buffer].profile, PROFILE_PRESENT);
 		SDL_RenderPresent(m_renderer);
 	}
+
+#ifdef RC_PROFILE
+	m_profiler.add_frame(m_frames[buffer].profile);
+#endif
+	m_free_buffers.push_back(buffer);
+	scale_resolution(m_frames[buffer].render_ms);
+}
+
+/*
+ * Render time goes with the pixel count, the square of the scale, so scale * sqrt(target_ms /
+ * average_ms) would have made the average frame take target_ms. The scale follows that at most
+ * PLANE_SCALE_STEP a frame, and only goes back up with PLANE_SCALE_HEADROOM to spare, so frames
+ * close to the target don't flip it between two sizes. The average is rescaled with the plane,
+ * frames already in flight don't keep pushing it the same way.
+ * */
+void rc::Engine::scale_resolution(double render_ms){
+	if(m_resolution.target_ms <= 0.0) return;
+
+	m_resolution.average_ms += (render_ms - m_resolution.average_ms) * RENDER_TIME_WEIGHT;
+
+	double target = m_resolution.target_ms;
+	double average = std::max(m_resolution.average_ms, 1e-3);
+	double scale = m_resolution.scale;
+	if(average > target){
+		scale = std::max(scale * sqrt(target / average), scale - PLANE_SCALE_STEP);
+	}else if(average < target * PLANE_SCALE_HEADROOM){
+		scale = std::min(scale * sqrt(target * PLANE_SCALE_HEADROOM / average), scale + PLANE_SCALE_STEP);
+	}
+	m_resolution.scale = std::clamp(scale, PLANE_SCALE_MIN, 1.0);
+
+	int w = static_cast<int>(lround(PROJ_PLANE_W * m_resolution.scale / PLANE_ALIGN)) * PLANE_ALIGN;
+	int h = static_cast<int>(lround(static_cast<double>(w) * PROJ_PLANE_H / PROJ_PLANE_W));
+	if(w == m_resolution.w && h == m_resolution.h) return;
+
+	m_resolution.average_ms *= static_cast<double>(w) * h / (static_cast<double>(m_resolution.w) * m_resolution.h);
+	m_resolution.w = w;
+	m_resolution.h = h;
+
+	// turns stay whole columns of the new plane, see Player::update().
+	m_sim_player.set_plane_width(w);
+	m_prev_player.set_plane_width(w);
 }
 
 void rc::Engine::blit(SDL_Texture * t, SDL_Rect * src, SDL_Rect * dest){
@@ -221,22 +551,32 @@ void rc::unpack_color(uint32_t color, uint8_t& r, uint8_t& g, uint8_t& b, uint8_
 	a = static_cast<uint8_t>(color & 0xff);
 }
 
+/* The sprites' distances are the camera's, render() updates them from the interpolated view.*/
 void rc::Engine::update(){
-	m_player->update(this);
-
-	for(auto& sprite : Core::m_sprites){
-		sprite.update();
-	}
+	m_sim_player.update(this);
 }
 
-void rc::Engine::draw(){
-	const uint32_t * fbuffer = render(DRAW_TEXT_MAPPED_WALLS);
-
-	int pitch = sizeof(uint32_t) * PROJ_PLANE_W;
+void rc::Engine::draw(int buffer){
+	SDL_Texture * texture = m_frame_textures[buffer];
+	RC_PROFILE_SCOPE(m_frames[buffer].profile, PROFILE_UPLOAD);
+
+	if(m_frames[buffer].target){
+		// already in the texture, unlocking uploads it if the renderer has to.
+		SDL_UnlockTexture(texture);
+	}else if(m_render_flags & TARGET_COLUMN_MAJOR){
+		// transposed straight into the texture.
+		void * pixels;
+		int pitch;
+		RC_DIE(SDL_LockTexture(texture, NULL, &pixels, &pitch) < 0, SDL_GetError());
+		copy_frame(reinterpret_cast<uint32_t *>(pixels), pitch, buffer);
+		SDL_UnlockTexture(texture);
+	}else{
+		int pitch = sizeof(uint32_t) * m_frames[buffer].w;
+		RC_DIE(SDL_UpdateTexture(texture, NULL, m_frames[buffer].pixels, pitch) < 0, SDL_GetError());
+	}
 
-	RC_DIE(SDL_UpdateTexture(m_fbuffer_texture, NULL, fbuffer, pitch) < 0, SDL_GetError());
 	RC_DIE(SDL_RenderSetViewport(m_renderer, &m_viewports["scene"]) < 0, SDL_GetError());
-	RC_DIE(SDL_RenderCopy(m_renderer, m_fbuffer_texture, NULL, NULL) < 0, SDL_GetError());
+	RC_DIE(SDL_RenderCopy(m_renderer, texture, NULL, NULL) < 0, SDL_GetError());
 
 //	draw the rays
 	//SDL_SetRenderDrawColor(m_renderer, 0xff, 0xff, 0xff, 0xff);
@@ -280,33 +620,82 @@ void rc::Engine::draw(){
 
 }
 
+#ifdef RC_PROFILE
+/*
+ * The p50, p95 and p99 of the frames so far as three bars in the top left corner, each the
+ * stages of that percentile end to end in their own color, in the order of Profile_stage. The
+ * white line is a frame at TARGET_FPS, half way across the window.
+ * */
+void rc::Engine::draw_profile(){
+	static const uint32_t colors[PROFILE_STAGES] = {
+		0x4e79a7ff, 0xf28e2bff, 0xe15759ff, 0x76b7b2ff, 0x59a14fff,
+		0xedc948ff, 0xb07aa1ff, 0xff9da7ff, 0x9c755fff, 0xbab0acff,
+	};
+	const int bar_h = 8;
+	double px_per_ms = screen_w * 0.5 / (target_time_per_frame * 1000.0);
+
+	Profile_stats stats[PROFILE_STAGES];
+	for(int i = 0; i < PROFILE_STAGES; i++){
+		stats[i] = m_profiler.stats(i);
+	}
+
+	for(int row = 0; row < 3; row++){
+		int x = 0;
+		for(int i = 0; i < PROFILE_STAGES; i++){
+			double ms = row == 0 ? stats[i].p50 : row == 1 ? stats[i].p95 : stats[i].p99;
+			SDL_Rect rect = {x, row * (bar_h + 2), static_cast<int>(ms * px_per_ms + 0.5), bar_h};
+			set_draw_color(colors[i]);
+			RC_DIE(SDL_RenderFillRect(m_renderer, &rect) < 0, SDL_GetError());
+			x += rect.w;
+		}
+	}
+
+	set_draw_color(0xffffffff);
+	RC_DIE(SDL_RenderDrawLine(m_renderer, screen_w / 2, 0, screen_w / 2, 3 * (bar_h + 2)) < 0, SDL_GetError());
+}
+#endif
+
 void rc::Engine::set_draw_color(uint32_t color){
 	uint8_t r, g, b, a;
 	unpack_color(color, r, g, b, a);
 	RC_DIE(SDL_SetRenderDrawColor(m_renderer, r, g, b, a) < 0, SDL_GetError());
 }
 
-SDL_Surface * rc::load_surface_RGBA(SDL_Renderer * renderer, const std::string& filename){
-	assert(renderer != NULL);
+/*
+ * The first format the renderer lists is the one it prefers. Only 32 bit ones with 8 bits a
+ * channel will do for the framebuffer, RGBA8888 if none is listed, SDL converts it then.
+ * */
+uint32_t rc::native_pixel_format(SDL_Renderer * renderer){
+	SDL_RendererInfo info;
+	RC_DIE(SDL_GetRendererInfo(renderer, &info) < 0, SDL_GetError());
+
+	for(uint32_t i = 0; i < info.num_texture_formats; i++){
+		uint32_t format = info.texture_formats[i];
+		if(SDL_PIXELTYPE(format) == SDL_PIXELTYPE_PACKED32 && SDL_PIXELLAYOUT(format) == SDL_PACKEDLAYOUT_8888){
+			return format;
+		}
+	}
+	return SDL_PIXELFORMAT_RGBA8888;
+}
+
+SDL_Surface * rc::load_surface(const std::string& filename, uint32_t format){
 	SDL_Surface * surface, * s;
 
 	RC_DIE(!(surface = IMG_Load(filename.c_str())), IMG_GetError());
-	RC_DIE(!(s = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_RGBA8888, 0)), IMG_GetError());
+	RC_DIE(!(s = SDL_ConvertSurfaceFormat(surface, format, 0)), SDL_GetError());
 
 	SDL_FreeSurface(surface);
 
 	return s;
 }
 
-SDL_Surface * rc::load_surface_RGBA(SDL_Renderer * renderer, const std::string& filename, uint32_t colorkey){
-	assert(renderer != NULL);
-	SDL_Surface * surface, * s;
-
-	RC_DIE(!(surface = IMG_Load(filename.c_str())), IMG_GetError());
-	RC_DIE(!(s = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_RGBA8888, 0)), IMG_GetError());
-	RC_DIE((SDL_SetColorKey(s, SDL_TRUE, colorkey) < 0), SDL_GetError());
+/* colorkey is RGBA8888 whatever format is, it's mapped to it the way the texels are.*/
+SDL_Surface * rc::load_surface(const std::string& filename, uint32_t format, uint32_t colorkey){
+	SDL_Surface * s = load_surface(filename, format);
 
-	SDL_FreeSurface(surface);
+	uint8_t r, g, b, a;
+	unpack_color(colorkey, r, g, b, a);
+	RC_DIE((SDL_SetColorKey(s, SDL_TRUE, SDL_MapRGBA(s->format, r, g, b, a)) < 0), SDL_GetError());
 
 	return s;
 }
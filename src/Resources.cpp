@@ -0,0 +1,159 @@
+#include "Resources.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "utils.h"
+
+static int aligned_size(int w, int h){
+	return (w * h + TEXTURE_ALIGN - 1) / TEXTURE_ALIGN * TEXTURE_ALIGN;
+}
+
+static int mip_levels(int w, int h){
+	int levels = 1;
+	while((w > 1 || h > 1) && levels < MIP_MAX_LEVELS){
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
+		levels++;
+	}
+	return levels;
+}
+
+/*
+ * Averages 2x2 blocks of src into dst, clamped at the edges of odd sized levels. Transparent
+ * texels of a keyed texture are left out of the average and the result is only transparent
+ * when most of the block was, so sprite outlines neither grow nor bleed the key color.
+ * */
+static void downsample(const rc::Mip_level& src, const rc::Mip_level& dst, uint32_t * dst_pixels, bool keyed, uint32_t key){
+	for(int y = 0; y < dst.h; y++){
+		for(int x = 0; x < dst.w; x++){
+			int x0 = x * 2, x1 = std::min(x * 2 + 1, src.w - 1);
+			int y0 = y * 2, y1 = std::min(y * 2 + 1, src.h - 1);
+			uint32_t block[4] = {src.pixels[y0 * src.w + x0], src.pixels[y0 * src.w + x1],
+								 src.pixels[y1 * src.w + x0], src.pixels[y1 * src.w + x1]};
+
+			uint32_t sum[4] = {0, 0, 0, 0};
+			uint32_t count = 0;
+			for(uint32_t c : block){
+				if(keyed && c == key) continue;
+				for(int i = 0; i < 4; i++) sum[i] += (c >> (i * 8)) & 0xff;
+				count++;
+			}
+
+			uint32_t color = key;
+			if(count >= 2){
+				color = 0;
+				for(int i = 0; i < 4; i++) color |= ((sum[i] + count / 2) / count) << (i * 8);
+				// an average can land on the key by accident, nudge it off.
+				if(keyed && color == key) color ^= 0x100;
+			}
+			dst_pixels[y * dst.w + x] = color;
+		}
+	}
+}
+
+/* Appends the opaque runs of every column of level, returns where its column_spans start.*/
+static size_t encode_spans(const rc::Mip_level& level, bool keyed, uint32_t key, std::vector<uint32_t>& column_spans,
+						   std::vector<rc::Texel_span>& spans, std::vector<uint32_t>& span_texels){
+	RC_DIE(level.h > UINT16_MAX, "texture too tall for texel spans");
+	size_t first = column_spans.size();
+
+	for(int x = 0; x < level.w; x++){
+		column_spans.push_back(spans.size());
+
+		int y = 0;
+		while(y < level.h){
+			for(; y < level.h && keyed && level.pixels[y * level.w + x] == key; y++);
+			if(y == level.h) break;
+
+			rc::Texel_span span = {static_cast<uint16_t>(y), 0, static_cast<uint32_t>(span_texels.size())};
+			for(; y < level.h && !(keyed && level.pixels[y * level.w + x] == key); y++){
+				span_texels.push_back(level.pixels[y * level.w + x]);
+			}
+			span.end = y;
+			spans.push_back(span);
+		}
+	}
+	column_spans.push_back(spans.size());
+
+	return first;
+}
+
+void rc::Resources::add_surface(int id, SDL_Surface * s){
+	RC_DIE(id < 0, "negative texture id");
+	m_surfaces[id] = s;
+	m_dirty = true;
+}
+
+void rc::Resources::build_atlas(){
+	if(!m_dirty) return;
+	m_dirty = false;
+
+	int count = 0;
+	size_t size = TEXTURE_ALIGN;
+	for(const auto& it : m_surfaces){
+		count = std::max(count, it.first + 1);
+
+		int w = it.second->w, h = it.second->h;
+		for(int l = 0; l < mip_levels(it.second->w, it.second->h); l++){
+			size += aligned_size(w, h);
+			w = (w + 1) / 2;
+			h = (h + 1) / 2;
+		}
+	}
+
+	m_textures.assign(count, Texture());
+	m_atlas.assign(size, 0);
+
+	// vector only guarantees the allocator's alignment, the first texture starts on the next line.
+	size_t offset = (TEXTURE_ALIGN - (reinterpret_cast<uintptr_t>(&m_atlas[0]) / sizeof(uint32_t)) % TEXTURE_ALIGN) % TEXTURE_ALIGN;
+
+	for(const auto& it : m_surfaces){
+		SDL_Surface * s = it.second;
+		RC_DIE(s->format->BytesPerPixel != 4, "textures must be 32 bit");
+
+		Texture& t = m_textures[it.first];
+		uint32_t * dst = &m_atlas[offset];
+		for(int y = 0; y < s->h; y++){
+			memcpy(dst + y * s->w, static_cast<const uint8_t *>(s->pixels) + y * s->pitch, s->w * sizeof(uint32_t));
+		}
+
+		t.pixels = dst;
+		t.w = s->w;
+		t.h = s->h;
+		t.keyed = SDL_GetColorKey(s, &t.key) == 0;
+		t.levels = mip_levels(s->w, s->h);
+		t.mips[0] = {dst, s->w, s->h};
+		offset += aligned_size(s->w, s->h);
+
+		for(int l = 1; l < t.levels; l++){
+			const Mip_level& above = t.mips[l - 1];
+			uint32_t * pixels = &m_atlas[offset];
+
+			t.mips[l] = {pixels, (above.w + 1) / 2, (above.h + 1) / 2};
+			downsample(above, t.mips[l], pixels, t.keyed, t.key);
+			offset += aligned_size(t.mips[l].w, t.mips[l].h);
+		}
+	}
+
+	// the span vectors only stop growing once every level is encoded, pointers are set after.
+	m_column_spans.clear();
+	m_spans.clear();
+	m_span_texels.clear();
+
+	std::vector<size_t> firsts;
+	for(const Texture& t : m_textures){
+		for(int l = 0; l < t.levels; l++){
+			firsts.push_back(encode_spans(t.mips[l], t.keyed, t.key, m_column_spans, m_spans, m_span_texels));
+		}
+	}
+
+	size_t i = 0;
+	for(Texture& t : m_textures){
+		for(int l = 0; l < t.levels; l++){
+			t.mips[l].column_spans = &m_column_spans[firsts[i++]];
+			t.mips[l].spans = m_spans.data();
+			t.mips[l].span_texels = m_span_texels.data();
+		}
+	}
+}
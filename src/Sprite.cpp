@@ -1,62 +1,127 @@
 #include "Sprite.h"
-#include <cstring>
-#include <iostream>
-#include "RC_Core.h"
-#include "utils.h"
+#include <algorithm>
+#include <cmath>
 
-rc::Sprite::Sprite(const Vec2f& pos, int id, Core * core) : 
-	position(pos), texture_id(id), m_core(core){
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+void rc::Sprites::add(const Vec2f& position, int id, uint32_t sprite_flags){
+	x.push_back(position.x);
+	y.push_back(position.y);
+	dist.push_back(0.0);
+	texture_id.push_back(id);
+	flags.push_back(sprite_flags);
+	cell.push_back(0);
+	mark.push_back(0);
 }
 
-rc::Sprite& rc::Sprite::operator= (const Sprite& other){
-	if(this != &other){
-		position = other.position;
-		texture_id = other.texture_id;
-	}
-	return *this;
+void rc::Sprites::clear(){
+	x.clear();
+	y.clear();
+	dist.clear();
+	texture_id.clear();
+	flags.clear();
+	cell.clear();
+	order.clear();
+	mark.clear();
 }
 
-void rc::Sprite::draw(const SDL_Rect& dim, double dist_from_player) const {
-	int start_x = dim.x;
-	int start_y = dim.y;
-	int sprite_w = dim.w;
-	int sprite_h = dim.h;
+void rc::Sprites::reserve(size_t count){
+	x.reserve(count);
+	y.reserve(count);
+	dist.reserve(count);
+	texture_id.reserve(count);
+	flags.reserve(count);
+	cell.reserve(count);
+	order.reserve(count);
+	mark.reserve(count);
+}
 
-	SDL_Surface * texture = m_core->m_resources->get_surface(texture_id);
+void rc::Sprites::select(const uint32_t * candidates, size_t count){
+	selection += 2;
+	if(selection < 2){
+		std::fill(mark.begin(), mark.end(), 0);
+		selection = 2;
+	}
+	for(size_t i = 0; i < count; i++){
+		mark[candidates[i]] = selection;
+	}
 
-	auto screen_2_texture_x = static_cast<double>(texture->w) / static_cast<double>(sprite_w);
-	auto screen_2_texture_y = static_cast<double>(texture->h) / static_cast<double>(sprite_w);
+	size_t kept = 0;
+	for(uint32_t index : order){
+		if(mark[index] == selection){
+			mark[index] = selection + 1;
+			order[kept++] = index;
+		}
+	}
+	order.resize(kept);
 
-	for(int x = 0; x < sprite_w; x++){
-		int screen_x = x + start_x;
+	for(size_t i = 0; i < count; i++){
+		if(mark[candidates[i]] == selection){
+			mark[candidates[i]] = selection + 1;
+			order.push_back(candidates[i]);
+		}
+	}
+}
 
-		if(dist_from_player < m_core->m_wall_dists[screen_x]){ // depth test
-			if((screen_x < m_core->m_proj_plane_w)){
-				for(int y = 0; y < sprite_h; y++){
+/* The same operations as (position(i) - p).length() in every lane, so the distances don't
+ * depend on whether a sprite went down the vector or the scalar path.*/
+void rc::Sprites::update_distances(const Vec2f& p){
+	const double * xs = x.data();
+	const double * ys = y.data();
+	double * d = dist.data();
+	const uint32_t * indices = order.data();
+	size_t n = order.size();
+	size_t i = 0;
 
-					int screen_y = start_y + y;
-					if(screen_y >= m_core->m_proj_plane_h) continue;
+#if defined(__SSE2__)
+	__m128d px = _mm_set1_pd(p.x);
+	__m128d py = _mm_set1_pd(p.y);
+	for(; i + 2 <= n; i += 2){
+		uint32_t a = indices[i], b = indices[i + 1];
+		__m128d dx = _mm_sub_pd(_mm_set_pd(xs[b], xs[a]), px);
+		__m128d dy = _mm_sub_pd(_mm_set_pd(ys[b], ys[a]), py);
+		__m128d length = _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)));
+		_mm_storel_pd(d + a, length);
+		_mm_storeh_pd(d + b, length);
+	}
+#endif
 
-					// TODO: may change to x << 6
-					int texture_x = x * screen_2_texture_x;
-					int texture_y = y * screen_2_texture_y;
+	for(; i < n; i++){
+		uint32_t a = indices[i];
+		double dx = xs[a] - p.x;
+		double dy = ys[a] - p.y;
+		d[a] = sqrt(dx * dx + dy * dy);
+	}
+}
 
-					uint32_t * pixels = reinterpret_cast<uint32_t *>(texture->pixels);
-					uint32_t pixel_color = pixels[texture_y * texture->w + texture_x];
+/*
+ * Insertion sort from last call's order. A sprite only moves past the ones it swapped places
+ * with since, so a camera that moved a step costs about one comparison per sprite. After a
+ * jump, a new level or new sprites, nearly everything is out of place and once the moves pass
+ * SPRITE_SORT_BUDGET per sprite the rest is left to std::sort.
+ * */
+void rc::Sprites::sort_by_distance(){
+	const double * d = dist.data();
+	auto nearer = [d](uint32_t a, uint32_t b){
+		return d[a] < d[b] || (d[a] == d[b] && a < b);
+	};
 
-					uint32_t color_key;
+	size_t budget = SPRITE_SORT_BUDGET * order.size();
+	size_t moves = 0;
+	for(size_t i = 1; i < order.size(); i++){
+		uint32_t index = order[i];
+		size_t j = i;
+		for(; j > 0 && nearer(index, order[j - 1]); j--){
+			order[j] = order[j - 1];
+		}
+		order[j] = index;
 
-					if(SDL_GetColorKey(texture, &color_key) < 0){
-						m_core->m_fbuffer.set_pixel(screen_x, screen_y, pixel_color);
-					}else if(pixel_color != color_key){
-						m_core->m_fbuffer.set_pixel(screen_x, screen_y, pixel_color);
-					}
-				}
-			}
+		moves += i - j;
+		if(moves > budget){
+			std::sort(order.begin(), order.end(), nearer);
+			return;
 		}
 	}
 }
-
-void rc::Sprite::update(){
-	last_dist_to_player = (position - m_core->m_player->position).length();
-}
@@ -0,0 +1,81 @@
+#include "Workers.h"
+
+#include <cassert>
+
+rc::Workers::Workers(size_t count){
+	m_count = count > 0 ? count : 1;
+	m_generation = 0;
+	m_busy = 0;
+	m_quit = false;
+	m_job = NULL;
+	m_jobs = 0;
+	m_next = 0;
+
+	for(size_t i = 1; i < m_count; i++){
+		m_threads.emplace_back(&Workers::loop, this, static_cast<int>(i));
+	}
+}
+
+rc::Workers::~Workers(){
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_start.notify_all();
+
+	for(auto& t : m_threads){
+		t.join();
+	}
+}
+
+void rc::Workers::work(int worker){
+	int job;
+	while((job = m_next.fetch_add(1, std::memory_order_relaxed)) < m_jobs){
+		(*m_job)(job, worker);
+	}
+}
+
+void rc::Workers::loop(int worker){
+	uint64_t seen = 0;
+
+	while(true){
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_start.wait(lock, [&](){ return m_quit || m_generation != seen; });
+			if(m_quit) return;
+			seen = m_generation;
+		}
+
+		work(worker);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(--m_busy == 0){
+			m_done.notify_one();
+		}
+	}
+}
+
+void rc::Workers::run(int jobs, const std::function<void(int, int)>& job){
+	if(m_threads.empty() || jobs <= 1){
+		for(int i = 0; i < jobs; i++) job(i, 0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		assert(m_busy == 0);
+
+		m_job = &job;
+		m_jobs = jobs;
+		m_next.store(0, std::memory_order_relaxed);
+		m_busy = m_threads.size();
+		m_generation++;
+	}
+	m_start.notify_all();
+
+	work(0);
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done.wait(lock, [&](){ return m_busy == 0; });
+	m_job = NULL;
+}
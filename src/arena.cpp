@@ -0,0 +1,46 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <cassert>
+
+static inline size_t align_up(size_t offset, const uint8_t * base, size_t align){
+	uintptr_t p = reinterpret_cast<uintptr_t>(base) + offset;
+	return offset + (align - p % align) % align;
+}
+
+void * rc::Arena::alloc(size_t size, size_t align){
+	assert(align > 0 && (align & (align - 1)) == 0);
+	uint8_t * p;
+
+	size_t offset = align_up(m_used, m_chunk.get(), align);
+	if(m_chunk && offset + size <= m_size){
+		p = m_chunk.get() + offset;
+		m_used = offset + size;
+	}else{
+		// past the chunk, into the newest extra one or a new one.
+		size_t extra_offset = m_extra.empty() ? 0 : align_up(m_extra_used, m_extra.back().get(), align);
+		if(m_extra.empty() || extra_offset + size > m_extra_size){
+			m_extra_full += m_extra_used;
+			m_extra_size = std::max({size + align, m_size, static_cast<size_t>(ARENA_MIN_CHUNK)});
+			m_extra.emplace_back(new uint8_t[m_extra_size]);
+			extra_offset = align_up(0, m_extra.back().get(), align);
+		}
+		p = m_extra.back().get() + extra_offset;
+		m_extra_used = extra_offset + size;
+	}
+
+	m_high_water = std::max(m_high_water, used());
+	return p;
+}
+
+/* An eighth on top of the high water mark leaves room for alignment that falls differently.*/
+void rc::Arena::reset(){
+	if(!m_extra.empty()){
+		m_extra.clear();
+		m_size = std::max(m_high_water + m_high_water / 8, static_cast<size_t>(ARENA_MIN_CHUNK));
+		m_chunk.reset(new uint8_t[m_size]);
+	}
+	m_used = 0;
+	m_extra_used = 0;
+	m_extra_full = 0;
+}
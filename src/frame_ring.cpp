@@ -0,0 +1,40 @@
+#include "frame_ring.h"
+
+#include <cassert>
+
+void rc::Frame_ring::push(int buffer){
+	uint32_t head = m_head.load(std::memory_order_relaxed);
+	assert(head - m_tail.load(std::memory_order_acquire) < FRAME_RING_SIZE);
+
+	m_slots[head % FRAME_RING_SIZE] = buffer;
+	m_head.store(head + 1, std::memory_order_seq_cst);
+
+	// pop() sets m_sleeping before it looks at m_head again, so one of the two sees the other.
+	if(m_sleeping.load(std::memory_order_seq_cst)){
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_wake.notify_one();
+	}
+}
+
+bool rc::Frame_ring::try_pop(int& buffer){
+	uint32_t tail = m_tail.load(std::memory_order_relaxed);
+	if(tail == m_head.load(std::memory_order_acquire)) return false;
+
+	buffer = m_slots[tail % FRAME_RING_SIZE];
+	m_tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+/* Waits for a buffer if there's none yet.*/
+int rc::Frame_ring::pop(){
+	int buffer;
+	while(!try_pop(buffer)){
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_sleeping.store(true, std::memory_order_seq_cst);
+		m_wake.wait(lock, [&](){
+			return m_tail.load(std::memory_order_relaxed) != m_head.load(std::memory_order_seq_cst);
+		});
+		m_sleeping.store(false, std::memory_order_relaxed);
+	}
+	return buffer;
+}
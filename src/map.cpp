@@ -1,4 +1,5 @@
 #include "map.h"
+#include <algorithm>
 #include "utils.h"
 #include "RC_Engine.h"
 
@@ -10,13 +11,74 @@
 static uint32_t _colors[4] = {BLACK, RED, GREEN, BLUE};
 
 rc::Map::Map(const uint32_t * _values, int map_w, int map_h){
-	assert(w <= MAP_MAX_SIZE && h <= MAP_MAX_SIZE);
+	assert(map_w <= MAP_MAX_SIZE && map_h <= MAP_MAX_SIZE);
 
-	values = std::vector<uint32_t>(_values, _values + (map_w * map_h));
 	w = map_w;
 	h = map_h;
+	chunks_w = (map_w + MAP_CHUNK_MASK) >> MAP_CHUNK_SHIFT;
+	chunks_h = (map_h + MAP_CHUNK_MASK) >> MAP_CHUNK_SHIFT;
 	cell_size = CELL_SIZE;
 	colors = _colors;
+
+	auto chunked = std::make_shared<std::vector<uint32_t>>(cell_count(), 0);
+	for(int y = 0; y < h; y++){
+		for(int x = 0; x < w; x++){
+			(*chunked)[index(x, y)] = _values[y * w + x];
+		}
+	}
+
+	cells = chunked->data();
+	storage = chunked;
+}
+
+rc::Map::Map(const uint32_t * chunked, int map_w, int map_h, std::shared_ptr<const void> owner){
+	assert(map_w <= MAP_MAX_SIZE && map_h <= MAP_MAX_SIZE);
+
+	w = map_w;
+	h = map_h;
+	chunks_w = (map_w + MAP_CHUNK_MASK) >> MAP_CHUNK_SHIFT;
+	chunks_h = (map_h + MAP_CHUNK_MASK) >> MAP_CHUNK_SHIFT;
+	cell_size = CELL_SIZE;
+	colors = _colors;
+	cells = chunked;
+	storage = std::move(owner);
+}
+
+std::vector<uint32_t> rc::Map::row_major() const {
+	std::vector<uint32_t> values(w * h);
+	for(int y = 0; y < h; y++){
+		for(int x = 0; x < w; x++){
+			values[y * w + x] = at(x, y);
+		}
+	}
+	return values;
+}
+
+std::vector<uint32_t> rc::bucket_sprites(const Map& map, const Vec2f * positions, size_t count){
+	size_t cells = static_cast<size_t>(map.w) * map.h;
+	std::vector<uint32_t> grid(cells + 1 + count, 0);
+	std::vector<uint32_t> sprite_cells(count);
+	uint32_t * start = &grid[0];
+	uint32_t * indices = start + cells + 1;
+
+	// counting sort
+	for(size_t i = 0; i < count; i++){
+		int x = std::clamp(static_cast<int>(positions[i].x / map.cell_size), 0, map.w - 1);
+		int y = std::clamp(static_cast<int>(positions[i].y / map.cell_size), 0, map.h - 1);
+		sprite_cells[i] = y * map.w + x;
+		start[sprite_cells[i] + 1]++;
+	}
+
+	for(size_t c = 0; c < cells; c++){
+		start[c + 1] += start[c];
+	}
+
+	std::vector<uint32_t> next(start, start + cells);
+	for(size_t i = 0; i < count; i++){
+		indices[next[sprite_cells[i]]++] = i;
+	}
+
+	return grid;
 }
 
 void rc::Map::draw(rc::Engine * engine, size_t window_w, size_t window_h){
@@ -0,0 +1,177 @@
+#include "map_file.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <set>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pvs.h"
+#include "utils.h"
+
+#define BYTE_ORDER_MARK 0x01020304
+
+static uint64_t align_up(uint64_t offset){
+	return (offset + MAP_FILE_ALIGN - 1) & ~static_cast<uint64_t>(MAP_FILE_ALIGN - 1);
+}
+
+static bool section_ok(const rc::Map_file_header& header, uint64_t offset, uint64_t bytes){
+	return offset % MAP_FILE_ALIGN == 0 && offset >= sizeof(header) &&
+		   offset <= header.file_size && bytes <= header.file_size - offset;
+}
+
+/*
+ * Only the header and the one sprite grid entry that has to equal the sprite count are read
+ * here, the cells are left to fault in as the renderer walks them.
+ * */
+rc::Map_file rc::load_map_file(const char * path){
+	int fd = open(path, O_RDONLY);
+	RC_DIE(fd < 0, "can't open map file");
+
+	struct stat st;
+	RC_DIE(fstat(fd, &st) < 0, "can't stat map file");
+	RC_DIE(static_cast<size_t>(st.st_size) < sizeof(Map_file_header), "map file is truncated");
+
+	size_t size = st.st_size;
+	void * addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	RC_DIE(addr == MAP_FAILED, "can't map map file");
+
+	std::shared_ptr<const void> mapping(addr, [size](const void * p){ munmap(const_cast<void *>(p), size); });
+	const uint8_t * base = static_cast<const uint8_t *>(addr);
+	const Map_file_header& header = *reinterpret_cast<const Map_file_header *>(base);
+
+	RC_DIE(memcmp(header.magic, MAP_FILE_MAGIC, sizeof(header.magic)), "not a map file");
+	RC_DIE(header.version != MAP_FILE_VERSION, "map file version doesn't match, convert it again");
+	RC_DIE(header.byte_order != BYTE_ORDER_MARK, "map file was written with the other byte order");
+	RC_DIE(header.file_size != size, "map file is truncated");
+	RC_DIE(header.w <= 0 || header.h <= 0 || header.w > MAP_MAX_SIZE || header.h > MAP_MAX_SIZE, "bad map file size");
+	RC_DIE(header.chunks_w != (header.w + MAP_CHUNK_MASK) >> MAP_CHUNK_SHIFT ||
+		   header.chunks_h != (header.h + MAP_CHUNK_MASK) >> MAP_CHUNK_SHIFT, "bad map file chunk count");
+
+	uint64_t cells = static_cast<uint64_t>(header.w) * header.h;
+	uint64_t chunked = static_cast<uint64_t>(header.chunks_w) * header.chunks_h * MAP_CHUNK_CELLS;
+	RC_DIE(!section_ok(header, header.cells_offset, chunked * sizeof(uint32_t)) ||
+		   !section_ok(header, header.sprites_offset, header.sprite_count * sizeof(Map_file_sprite)) ||
+		   !section_ok(header, header.sprite_grid_offset, (cells + 1 + header.sprite_count) * sizeof(uint32_t)) ||
+		   !section_ok(header, header.textures_offset, header.texture_count * sizeof(uint32_t)), "bad map file section");
+
+	Map_file file;
+	file.map = Map(reinterpret_cast<const uint32_t *>(base + header.cells_offset), header.w, header.h, mapping);
+	file.map.cell_size = header.cell_size;
+	file.spawn = Vec2f(header.spawn_x, header.spawn_y);
+	file.sprites = reinterpret_cast<const Map_file_sprite *>(base + header.sprites_offset);
+	file.sprite_count = header.sprite_count;
+	file.sprite_grid = reinterpret_cast<const uint32_t *>(base + header.sprite_grid_offset);
+	file.textures = reinterpret_cast<const uint32_t *>(base + header.textures_offset);
+	file.texture_count = header.texture_count;
+
+	RC_DIE(file.sprite_grid[cells] != header.sprite_count, "bad map file sprite grid");
+
+	if(header.pvs_cell_sets_offset){
+		RC_DIE(!section_ok(header, header.pvs_cell_sets_offset, cells * sizeof(uint32_t)) ||
+			   !section_ok(header, header.pvs_sets_offset, header.pvs_set_count * sizeof(Pvs_set)) ||
+			   !section_ok(header, header.pvs_bits_offset, header.pvs_bit_words * sizeof(uint64_t)), "bad map file pvs section");
+
+		auto pvs = std::make_shared<Pvs>();
+		pvs->w = header.w;
+		pvs->h = header.h;
+		pvs->cell_sets = reinterpret_cast<const uint32_t *>(base + header.pvs_cell_sets_offset);
+		pvs->sets = reinterpret_cast<const Pvs_set *>(base + header.pvs_sets_offset);
+		pvs->bits = reinterpret_cast<const uint64_t *>(base + header.pvs_bits_offset);
+		pvs->set_count = header.pvs_set_count;
+		pvs->bit_words = header.pvs_bit_words;
+		pvs->storage = mapping;
+		file.map.pvs = pvs;
+	}
+
+	return file;
+}
+
+static void write_section(FILE * f, uint64_t offset, const void * data, size_t bytes){
+	RC_DIE(fseek(f, offset, SEEK_SET) < 0, "can't seek in map file");
+	RC_DIE(bytes && fwrite(data, bytes, 1, f) != 1, "can't write map file");
+}
+
+void rc::save_map_file(const char * path, const Map& map, const Vec2f& spawn,
+					   const std::vector<Vec2f>& positions, const std::vector<uint32_t>& sprite_textures){
+	assert(positions.size() == sprite_textures.size());
+
+	// bucketed where the loader will see them, a position rounded to float can cross into the next cell.
+	std::vector<Map_file_sprite> sprites(positions.size());
+	std::vector<Vec2f> stored(positions.size());
+	for(size_t i = 0; i < positions.size(); i++){
+		sprites[i] = {static_cast<float>(positions[i].x), static_cast<float>(positions[i].y), sprite_textures[i], 0};
+		stored[i] = Vec2f(sprites[i].x, sprites[i].y);
+	}
+
+	std::vector<uint32_t> sprite_grid = bucket_sprites(map, stored.data(), stored.size());
+
+	std::set<uint32_t> used(sprite_textures.begin(), sprite_textures.end());
+	for(int y = 0; y < map.h; y++){
+		for(int x = 0; x < map.w; x++){
+			uint32_t cell = map.at(x, y);
+			if(cell & WALL_BIT){
+				used.insert((cell >> 8) & 0xff);
+			}else if(cell & FLOOR_CEIL_BIT){
+				used.insert((cell >> 16) & 0xff);
+				used.insert((cell >> 8) & 0xff);
+			}
+		}
+	}
+	// every texture a cell or sprite uses is listed, load_map_file() relies on that rather than read the cells.
+	std::vector<uint32_t> textures(used.begin(), used.end());
+
+	Map_file_header header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MAP_FILE_MAGIC, sizeof(header.magic));
+	header.version = MAP_FILE_VERSION;
+	header.byte_order = BYTE_ORDER_MARK;
+	header.w = map.w;
+	header.h = map.h;
+	header.chunks_w = map.chunks_w;
+	header.chunks_h = map.chunks_h;
+	header.cell_size = map.cell_size;
+	header.sprite_count = sprites.size();
+	header.texture_count = textures.size();
+	header.spawn_x = spawn.x;
+	header.spawn_y = spawn.y;
+
+	header.cells_offset = align_up(sizeof(header));
+	header.sprites_offset = align_up(header.cells_offset + map.cell_count() * sizeof(uint32_t));
+	header.sprite_grid_offset = align_up(header.sprites_offset + sprites.size() * sizeof(Map_file_sprite));
+	header.textures_offset = align_up(header.sprite_grid_offset + sprite_grid.size() * sizeof(uint32_t));
+	header.file_size = header.textures_offset + textures.size() * sizeof(uint32_t);
+
+	const Pvs * pvs = map.pvs.get();
+	if(pvs){
+		assert(pvs->w == map.w && pvs->h == map.h);
+		header.pvs_set_count = pvs->set_count;
+		header.pvs_bit_words = pvs->bit_words;
+		header.pvs_cell_sets_offset = align_up(header.file_size);
+		header.pvs_sets_offset = align_up(header.pvs_cell_sets_offset + static_cast<uint64_t>(map.w) * map.h * sizeof(uint32_t));
+		header.pvs_bits_offset = align_up(header.pvs_sets_offset + pvs->set_count * sizeof(Pvs_set));
+		header.file_size = header.pvs_bits_offset + pvs->bit_words * sizeof(uint64_t);
+	}
+
+	FILE * f = fopen(path, "wb");
+	RC_DIE(!f, "can't create map file");
+
+	write_section(f, 0, &header, sizeof(header));
+	write_section(f, header.cells_offset, map.cells, map.cell_count() * sizeof(uint32_t));
+	write_section(f, header.sprites_offset, sprites.data(), sprites.size() * sizeof(Map_file_sprite));
+	write_section(f, header.sprite_grid_offset, sprite_grid.data(), sprite_grid.size() * sizeof(uint32_t));
+	write_section(f, header.textures_offset, textures.data(), textures.size() * sizeof(uint32_t));
+	if(pvs){
+		write_section(f, header.pvs_cell_sets_offset, pvs->cell_sets, static_cast<size_t>(map.w) * map.h * sizeof(uint32_t));
+		write_section(f, header.pvs_sets_offset, pvs->sets, pvs->set_count * sizeof(Pvs_set));
+		write_section(f, header.pvs_bits_offset, pvs->bits, pvs->bit_words * sizeof(uint64_t));
+	}
+
+	// a map with no sprites and no textures would end on a hole, make sure the file is that long.
+	RC_DIE(fflush(f) != 0 || ftruncate(fileno(f), header.file_size) < 0, "can't write map file");
+	RC_DIE(fclose(f) != 0, "can't write map file");
+}
@@ -0,0 +1,174 @@
+#include "map_gen.h"
+
+#include <random>
+#include <algorithm>
+#include <climits>
+
+#define GEN_FLOOR FLCL(0, 0, 3)
+
+static const int dirs[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+
+/*
+ * Maze pass, a depth first walk over the cells with odd coordinates carving the wall
+ * between each cell and the next. While a corridor is shorter than corridor_length it keeps
+ * going straight if it can, which gives long corridors for large values and a twisty
+ * maze for small ones.
+ * */
+static void carve_maze(std::vector<uint8_t>& open, int w, int h, int corridor_length, std::mt19937& rng){
+	auto carvable = [&](int x, int y){
+		return x > 0 && y > 0 && x < w - 1 && y < h - 1 && !open[y * w + x];
+	};
+
+	std::vector<int> stack;
+	stack.push_back(w + 1);
+	open[w + 1] = 1;
+
+	int last_dir = -1;
+	int run = 0;
+
+	while(!stack.empty()){
+		int cx = stack.back() % w;
+		int cy = stack.back() / w;
+
+		int candidates[4];
+		int n = 0;
+		bool can_continue = false;
+
+		for(int d = 0; d < 4; d++){
+			if(carvable(cx + dirs[d][0] * 2, cy + dirs[d][1] * 2)){
+				candidates[n++] = d;
+				can_continue |= (d == last_dir);
+			}
+		}
+
+		if(n == 0){
+			stack.pop_back();
+			last_dir = -1;
+			run = 0;
+			continue;
+		}
+
+		int d;
+		if(can_continue && run < corridor_length){
+			d = last_dir;
+		}else{
+			d = candidates[rng() % n];
+		}
+
+		run = (d == last_dir) ? run + 2 : 2;
+		last_dir = d;
+
+		open[(cy + dirs[d][1]) * w + (cx + dirs[d][0])] = 1;
+		cx += dirs[d][0] * 2;
+		cy += dirs[d][1] * 2;
+		open[cy * w + cx] = 1;
+		stack.push_back(cy * w + cx);
+	}
+}
+
+/* Rooms pass, random rectangles carved until open_ratio of the interior is floor. */
+static void carve_rooms(std::vector<uint8_t>& open, int w, int h, double open_ratio, std::mt19937& rng){
+	int interior_w = w - 2;
+	int interior_h = h - 2;
+	size_t target = static_cast<size_t>(open_ratio * interior_w * interior_h);
+
+	if(open_ratio >= 1.0){
+		for(int y = 1; y < h - 1; y++){
+			std::fill(open.begin() + y * w + 1, open.begin() + y * w + w - 1, 1);
+		}
+		return;
+	}
+
+	size_t open_cells = std::count(open.begin(), open.end(), 1);
+
+	std::uniform_int_distribution<int> room_w(std::min(3, interior_w), std::max(3, interior_w / 4));
+	std::uniform_int_distribution<int> room_h(std::min(3, interior_h), std::max(3, interior_h / 4));
+
+	for(int attempts = 0; open_cells < target && attempts < 10000; attempts++){
+		int rw = std::min(room_w(rng), interior_w);
+		int rh = std::min(room_h(rng), interior_h);
+		int rx = 1 + rng() % (interior_w - rw + 1);
+		int ry = 1 + rng() % (interior_h - rh + 1);
+
+		for(int y = ry; y < ry + rh; y++){
+			for(int x = rx; x < rx + rw; x++){
+				if(!open[y * w + x]){
+					open[y * w + x] = 1;
+					open_cells++;
+				}
+			}
+		}
+	}
+}
+
+/* Pillars only go where all four neighbours are floor, so corridors are never cut. */
+static void place_pillars(std::vector<uint8_t>& open, int w, int h, double wall_density, std::mt19937& rng){
+	if(wall_density <= 0.0) return;
+
+	std::uniform_real_distribution<double> u(0.0, 1.0);
+	std::vector<uint8_t> carved = open;
+
+	for(int y = 1; y < h - 1; y++){
+		for(int x = 1; x < w - 1; x++){
+			bool surrounded = carved[y * w + x] &&
+							  carved[y * w + x - 1] && carved[y * w + x + 1] &&
+							  carved[(y - 1) * w + x] && carved[(y + 1) * w + x];
+
+			if(surrounded && u(rng) < wall_density){
+				open[y * w + x] = 0;
+			}
+		}
+	}
+}
+
+rc::Generated_map rc::generate_map(const Map_gen_params& params){
+	int w = params.w;
+	int h = params.h;
+	assert(w >= 3 && h >= 3);
+
+	std::mt19937 rng(params.seed);
+	std::vector<uint8_t> open(w * h, 0);
+
+	carve_maze(open, w, h, params.corridor_length, rng);
+	carve_rooms(open, w, h, params.open_ratio, rng);
+	place_pillars(open, w, h, params.wall_density, rng);
+
+	// spawn on the floor cell closest to the middle
+	int spawn = -1;
+	long best = LONG_MAX;
+	for(int y = 1; y < h - 1; y++){
+		for(int x = 1; x < w - 1; x++){
+			long d = static_cast<long>(x - w / 2) * (x - w / 2) + static_cast<long>(y - h / 2) * (y - h / 2);
+			if(open[y * w + x] && d < best){
+				best = d;
+				spawn = y * w + x;
+			}
+		}
+	}
+	assert(spawn >= 0);
+
+	std::vector<uint32_t> values(w * h);
+	std::vector<int> floor_cells;
+	for(int i = 0; i < w * h; i++){
+		uint32_t texture = 1 + (rng() & 1);
+		values[i] = open[i] ? GEN_FLOOR : WALL(texture);
+
+		if(open[i] && i != spawn) floor_cells.push_back(i);
+	}
+
+	Generated_map gen;
+	gen.map = Map(&values[0], w, h);
+	gen.spawn = Vec2f((spawn % w) * CELL_SIZE + CELL_SIZE / 2, (spawn / w) * CELL_SIZE + CELL_SIZE / 2);
+
+	// several sprites can share a cell, the jitter keeps them from overlapping exactly.
+	if(!floor_cells.empty()){
+		std::uniform_real_distribution<double> jitter(-CELL_SIZE / 4, CELL_SIZE / 4);
+		for(int i = 0; i < params.sprites; i++){
+			int cell = floor_cells[rng() % floor_cells.size()];
+			gen.sprites.push_back(Vec2f((cell % w) * CELL_SIZE + CELL_SIZE / 2 + jitter(rng),
+										(cell / w) * CELL_SIZE + CELL_SIZE / 2 + jitter(rng)));
+		}
+	}
+
+	return gen;
+}
@@ -1,15 +1,19 @@
 #include "memory.h"
 
-static Block * RC_create_block(size_t element_size){
+#include <algorithm>
+#include <cstddef>
+
+static Block * RC_create_block(size_t element_size, size_t align){
 	Block * block = static_cast<Block *>(malloc(sizeof(Block)));
 	assert(block != NULL);
 	block->elem_cap = DEFAULT_BLOCK_CAP;
 	block->count = 0;
 	block->next = NULL;
 
+	// element_size is a multiple of align, so the size is too, as aligned_alloc wants it.
 	size_t size = element_size * block->elem_cap;
-	block->buffer = static_cast<uint8_t *>(malloc(sizeof(uint8_t) * size));
-	assert(block != NULL);
+	block->buffer = static_cast<uint8_t *>(aligned_alloc(align, sizeof(uint8_t) * size));
+	assert(block->buffer != NULL);
 
 	memset(block->buffer, 0, sizeof(uint8_t) * size);
 
@@ -23,18 +27,29 @@ static void RC_destroy_block(Block * block){
 }
 
 RC_MemPool * RC_create_mempool(size_t cap, size_t element_size){
+	return RC_create_aligned_mempool(cap, element_size, alignof(std::max_align_t));
+}
+
+/* align is a power of two, cap the number of blocks to start with, START_BLOCKS_CAP at least.*/
+RC_MemPool * RC_create_aligned_mempool(size_t cap, size_t element_size, size_t align){
 	RC_MemPool * pool = static_cast<RC_MemPool *>(malloc(sizeof(RC_MemPool)));
 
 	assert(pool != NULL);
+	assert(align > 0 && (align & (align - 1)) == 0);
+
+	// a free slot holds the free list link.
+	align = std::max(align, alignof(FreeAddr));
+	element_size = std::max(element_size, sizeof(FreeAddr));
 
-	pool->cap = MAX(START_BLOCKS_CAP, 1);
-	pool->element_size = MAX(element_size, sizeof(struct FreeAddr));
+	pool->cap = std::max<size_t>(cap, START_BLOCKS_CAP);
+	pool->align = align;
+	pool->element_size = (element_size + align - 1) & ~(align - 1);
 	pool->start = pool->end = NULL;
 	pool->free_addrs = NULL;
 
 	// insert cap blocks
 	for(size_t i = 0; i < pool->cap; i++){
-		Block * b = RC_create_block(pool->element_size);
+		Block * b = RC_create_block(pool->element_size, pool->align);
 
 		if(pool->start == NULL && pool->end == NULL){
 			pool->start = pool->end = b;
@@ -60,14 +75,15 @@ void * RC_mempool_alloc(RC_MemPool * pool){
 		return mem;
 	}
 
-	if(pool->curr_block->count + 1 >= pool->curr_block->elem_cap){
+	// blocks are filled in order, only the one after the current block can have room left.
+	if(pool->curr_block->count >= pool->curr_block->elem_cap){
 		pool->curr_block = pool->curr_block->next;
 		if(pool->curr_block == NULL){ // ran out of blocks
 			size_t new_cap = pool->cap * 2;
 
 			// insert new_cap - old_cap new blocks
 			for(size_t i = pool->cap; i < new_cap; i++){
-				Block * new_block = RC_create_block(pool->element_size);
+				Block * new_block = RC_create_block(pool->element_size, pool->align);
 
 				if(i == pool->cap){
 					pool->curr_block = new_block;
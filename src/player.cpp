@@ -3,11 +3,7 @@
 
 rc::Player::Player(int projection_plane_w){
 	fov = FOV;
-
-	double half_fov = to_rad(fov * 0.5);
-	int half_plane_w = projection_plane_w / 2;
-
-	dist_from_proj_plane = static_cast<double>(half_plane_w) / tan(half_fov);
+	set_plane_width(projection_plane_w);
 
 	height = PLAYER_HEIGHT;
 	viewing_angle = PLAYER_VIEWING_ANGLE;
@@ -16,6 +12,16 @@ rc::Player::Player(int projection_plane_w){
 
 	speed = 80.0f;
 	rotation_speed = 120.0f;
+	turn_remainder = 0.0;
+}
+
+/* The plane is half_plane_w away from the eye for the fov to span it.*/
+void rc::Player::set_plane_width(int projection_plane_w){
+	double half_fov = to_rad(fov * 0.5);
+	int half_plane_w = projection_plane_w / 2;
+
+	dist_from_proj_plane = static_cast<double>(half_plane_w) / tan(half_fov);
+	column_angle = fov / projection_plane_w;
 }
 
 void rc::Player::draw(const Map * map, Engine * engine){
@@ -48,7 +54,12 @@ void rc::Player::update(const rc::Engine * engine){
 
 	if(pressed_d || pressed_a){
 		double _speed = rotation_speed * delta_time;
-		viewing_angle += pressed_d ? -_speed : _speed;
+		turn_remainder += pressed_d ? -_speed : _speed;
+
+		// so every column of a turned frame looks along a ray of the last one, see REPROJECT_ROTATION.
+		double columns = trunc(turn_remainder / column_angle);
+		viewing_angle += columns * column_angle;
+		turn_remainder -= columns * column_angle;
 
 		if(viewing_angle > 360.0) viewing_angle -= 360.0;
 		if(viewing_angle < 0.0) viewing_angle += 360.0;
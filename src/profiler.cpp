@@ -0,0 +1,109 @@
+#include "profiler.h"
+
+#ifdef RC_PROFILE
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "utils.h"
+
+static const char * stage_names[rc::PROFILE_STAGES] = {
+	"input",
+	"update",
+	"traversal",
+	"walls",
+	"floor",
+	"ceiling",
+	"sprite_sort",
+	"sprites",
+	"upload",
+	"present",
+};
+
+const char * rc::profile_stage_name(int stage){
+	return stage_names[stage];
+}
+
+uint64_t rc::profile_now_ns(){
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+rc::Profiler::Profiler() : m_window(PROFILE_WINDOW), m_count(0), m_file(NULL), m_trace(false){
+	m_start_ns = profile_now_ns();
+}
+
+rc::Profiler::~Profiler(){
+	if(!m_file) return;
+	if(m_trace) fprintf(m_file, "\n]\n");
+	fclose(m_file);
+}
+
+void rc::Profiler::open(const char * path){
+	RC_DIE(!(m_file = fopen(path, "w")), "can't open the profile output");
+
+	size_t len = strlen(path);
+	m_trace = len >= 5 && !strcmp(path + len - 5, ".json");
+
+	if(m_trace){
+		fprintf(m_file, "[");
+		return;
+	}
+
+	fprintf(m_file, "frame,time_ms");
+	for(int i = 0; i < PROFILE_STAGES; i++){
+		fprintf(m_file, ",%s", stage_names[i]);
+	}
+	fprintf(m_file, "\n");
+}
+
+void rc::Profiler::add_frame(const Profile_times& times){
+	m_window[m_count % PROFILE_WINDOW] = times;
+
+	if(m_file){
+		double time_ms = (profile_now_ns() - m_start_ns) / 1e6;
+		if(m_trace){
+			// ts is in us.
+			fprintf(m_file, "%s\n{\"name\":\"frame\",\"ph\":\"C\",\"pid\":1,\"tid\":1,\"ts\":%.0f,\"args\":{",
+					m_count ? "," : "", time_ms * 1000.0);
+			for(int i = 0; i < PROFILE_STAGES; i++){
+				fprintf(m_file, "%s\"%s\":%.4f", i ? "," : "", stage_names[i], times.ns[i] / 1e6);
+			}
+			fprintf(m_file, "}}");
+		}else{
+			fprintf(m_file, "%llu,%.3f", static_cast<unsigned long long>(m_count), time_ms);
+			for(int i = 0; i < PROFILE_STAGES; i++){
+				fprintf(m_file, ",%.4f", times.ns[i] / 1e6);
+			}
+			fprintf(m_file, "\n");
+		}
+	}
+
+	m_count++;
+}
+
+/* Nearest rank percentiles over the frames in the window.*/
+rc::Profile_stats rc::Profiler::stats(int stage) const {
+	size_t n = std::min<uint64_t>(m_count, PROFILE_WINDOW);
+	if(n == 0) return {0.0, 0.0, 0.0};
+
+	uint64_t values[PROFILE_WINDOW];
+	for(size_t i = 0; i < n; i++){
+		values[i] = m_window[i].ns[stage];
+	}
+	std::sort(values, values + n);
+
+	auto rank = [&](double p){ return values[static_cast<size_t>(p * (n - 1) + 0.5)] / 1e6; };
+	return {rank(0.5), rank(0.95), rank(0.99)};
+}
+
+void rc::Profiler::print(FILE * out) const {
+	fprintf(out, "%-12s %8s %8s %8s   (ms, last %llu frames)\n", "stage", "p50", "p95", "p99",
+			static_cast<unsigned long long>(std::min<uint64_t>(m_count, PROFILE_WINDOW)));
+	for(int i = 0; i < PROFILE_STAGES; i++){
+		Profile_stats s = stats(i);
+		fprintf(out, "%-12s %8.3f %8.3f %8.3f\n", stage_names[i], s.p50, s.p95, s.p99);
+	}
+}
+
+#endif
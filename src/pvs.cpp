@@ -0,0 +1,266 @@
+#include "pvs.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+/* In cells, rays that graze a corner by this much are let through. The intercept walks test a
+ * unit past the grid lines they cross going left or up, so they see through a wall's corner
+ * by up to a unit, and the float traversal may not stop them either.*/
+#define PVS_EPSILON (2.0 / CELL_SIZE)
+
+static_assert(PVS_MAX_BIT_WORDS <= UINT32_MAX, "Pvs_set::bits must hold every offset");
+
+struct Pvs_data{
+	std::vector<uint32_t> cell_sets;
+	std::vector<rc::Pvs_set> sets;
+	std::vector<uint64_t> bits;
+};
+
+/* Sets of one map row, bits offsets relative to this row until they're all put together.*/
+struct Pvs_row{
+	std::vector<int> xs;
+	std::vector<rc::Pvs_set> sets;
+	std::vector<uint64_t> bits;
+};
+
+/* v interval where rays cross into a column.*/
+struct Pvs_span{
+	double lo;
+	double hi;
+};
+
+struct Pvs_scratch{
+	std::vector<uint8_t> seen;
+	std::vector<int> touched;
+	std::vector<Pvs_span> spans;
+	std::vector<Pvs_span> next;
+
+	inline void mark(int cell){
+		if(!seen[cell]){
+			seen[cell] = 1;
+			touched.push_back(cell);
+		}
+	}
+};
+
+/*
+ * The map seen along one axis: u is the column the beam is in, growing away from the source,
+ * v is the cell across it. Quadrants 0 and 1 walk +x and -x, 2 and 3 walk +y and -y. The
+ * wall bits are copied out once in that order, with a wall row on both sides of every column.
+ * */
+struct Pvs_view{
+	const rc::Map& map;
+	int quadrant;
+	int u_size;
+	int v_size;
+	std::vector<uint8_t> walls;
+
+	Pvs_view(const rc::Map& map, int quadrant) : map(map), quadrant(quadrant){
+		u_size = quadrant < 2 ? map.w : map.h;
+		v_size = quadrant < 2 ? map.h : map.w;
+
+		walls.assign(static_cast<size_t>(u_size) * (v_size + 2), 1);
+		for(int u = 0; u < u_size; u++){
+			for(int v = 0; v < v_size; v++){
+				int c = cell(u, v);
+				walls[u * (v_size + 2) + v + 1] = (map.at(c % map.w, c / map.w) & WALL_BIT) != 0;
+			}
+		}
+	};
+
+	inline int cell(int u, int v) const {
+		switch(quadrant){
+			case 0: return v * map.w + u;
+			case 1: return v * map.w + (map.w - 1 - u);
+			case 2: return u * map.w + v;
+			default: return (map.h - 1 - u) * map.w + v;
+		}
+	};
+
+	inline int source_u(int x, int y) const {
+		switch(quadrant){
+			case 0: return x;
+			case 1: return map.w - 1 - x;
+			case 2: return y;
+			default: return map.h - 1 - y;
+		}
+	};
+
+	// v from -1 to v_size.
+	inline bool wall(int u, int v) const {
+		return walls[u * (v_size + 2) + v + 1];
+	};
+};
+
+/*
+ * Pushes every ray that leaves the source cell with a slope in [s0, s1] across its quadrant a
+ * column at a time. spans holds where those rays can cross the near edge of column u, as v
+ * intervals. A ray goes on within the run of open cells it enters and stops at the first wall,
+ * so each interval is widened by what the slopes add over one column and clipped to its run,
+ * the walls that clip it are marked as seen along with the open cells from where it comes into
+ * the column to where it leaves it. Which slope is where is forgotten from one column to the
+ * next, that only ever lets more through.
+ * */
+static void sweep(const Pvs_view& view, Pvs_scratch& scratch, int source_u, int source_v, double s0, double s1){
+	scratch.spans.assign(1, Pvs_span{static_cast<double>(source_v), source_v + 1.0});
+
+	for(int u = source_u; u < view.u_size && !scratch.spans.empty(); u++){
+		// the source cell's own column is crossed from anywhere inside it, a shorter run than a full column.
+		double lo_step = u == source_u ? std::min(0.0, s0) : s0;
+		double hi_step = u == source_u ? std::max(0.0, s1) : s1;
+
+		scratch.next.clear();
+		for(const auto& span : scratch.spans){
+			int first = std::max(0, static_cast<int>(floor(span.lo)));
+			int last = std::min(view.v_size - 1, static_cast<int>(ceil(span.hi)) - 1);
+
+			for(int v = first; v <= last; v++){
+				if(view.wall(u, v)){
+					scratch.mark(view.cell(u, v));
+					continue;
+				}
+
+				// the run of open cells from v, and how far the rays entering it can get.
+				int run_first = v;
+				while(v + 1 <= last && !view.wall(u, v + 1)) v++;
+				int run_last = v;
+
+				// where the rays come into the run, and how far across they can be where they leave it.
+				double near_lo = std::max(span.lo, static_cast<double>(run_first));
+				double near_hi = std::min(span.hi, run_last + 1.0);
+				double lo = near_lo + lo_step - PVS_EPSILON;
+				double hi = near_hi + hi_step + PVS_EPSILON;
+
+				while(run_first > 0 && lo < run_first && !view.wall(u, run_first - 1)) run_first--;
+				while(run_last < view.v_size - 1 && hi > run_last + 1 && !view.wall(u, run_last + 1)) run_last++;
+				if(lo < run_first && run_first > 0) scratch.mark(view.cell(u, run_first - 1));
+				if(hi > run_last + 1 && run_last < view.v_size - 1) scratch.mark(view.cell(u, run_last + 1));
+
+				// rays within PVS_EPSILON of the walls at either end graze their corners and go on.
+				lo = std::max(lo, run_first - PVS_EPSILON);
+				hi = std::min(hi, run_last + 1.0 + PVS_EPSILON);
+
+				// every cell between the two, a ray crossing the column goes through all of them.
+				for(int c = static_cast<int>(floor(std::min(near_lo, lo))); c < std::max(near_hi, hi); c++){
+					scratch.mark(view.cell(u, c));
+				}
+				if(lo >= hi) continue;
+				scratch.next.push_back({lo, hi});
+			}
+		}
+
+		// spans come out sorted by v, merge the ones the widening made overlap.
+		scratch.spans.clear();
+		for(const auto& span : scratch.next){
+			if(!scratch.spans.empty() && span.lo <= scratch.spans.back().hi){
+				scratch.spans.back().hi = std::max(scratch.spans.back().hi, span.hi);
+			}else{
+				scratch.spans.push_back(span);
+			}
+		}
+	}
+}
+
+static void build_cell(const rc::Map& map, const std::vector<Pvs_view>& views, Pvs_scratch& scratch, int x, int y, Pvs_row& row,
+					   std::atomic<uint64_t>& words){
+	scratch.mark(y * map.w + x);
+	for(const auto& view : views){
+		int v = view.quadrant < 2 ? y : x;
+		for(int i = 0; i < PVS_BEAMS; i++){
+			sweep(view, scratch, view.source_u(x, y), v, -1.0 + 2.0 * i / PVS_BEAMS, -1.0 + 2.0 * (i + 1) / PVS_BEAMS);
+		}
+	}
+
+	// grow by a cell, a sprite is a cell wide and shows up in the cells next to its own.
+	size_t hit = scratch.touched.size();
+	for(size_t i = 0; i < hit; i++){
+		int cx = scratch.touched[i] % map.w;
+		int cy = scratch.touched[i] / map.w;
+		for(int ny = std::max(0, cy - 1); ny <= std::min(map.h - 1, cy + 1); ny++){
+			for(int nx = std::max(0, cx - 1); nx <= std::min(map.w - 1, cx + 1); nx++){
+				scratch.mark(ny * map.w + nx);
+			}
+		}
+	}
+
+	int x0 = map.w, y0 = map.h, x1 = -1, y1 = -1;
+	for(int cell : scratch.touched){
+		int cx = cell % map.w;
+		int cy = cell / map.w;
+		x0 = std::min(x0, cx);
+		y0 = std::min(y0, cy);
+		x1 = std::max(x1, cx);
+		y1 = std::max(y1, cy);
+	}
+
+	rc::Pvs_set set;
+	set.x0 = x0;
+	set.y0 = y0;
+	set.w = x1 - x0 + 1;
+	set.h = y1 - y0 + 1;
+	set.bits = row.bits.size();
+
+	// a row's offsets are at most the total, so checking it keeps them all in 32 bits.
+	size_t set_words = (static_cast<size_t>(set.w) * set.h + 63) / 64;
+	RC_DIE(words.fetch_add(set_words) + set_words > PVS_MAX_BIT_WORDS, "pvs bits past PVS_MAX_BIT_WORDS");
+	row.bits.resize(row.bits.size() + set_words, 0);
+	for(int cell : scratch.touched){
+		uint64_t bit = static_cast<uint64_t>(cell / map.w - y0) * set.w + (cell % map.w - x0);
+		row.bits[set.bits + (bit >> 6)] |= 1ull << (bit & 63);
+		scratch.seen[cell] = 0;
+	}
+	scratch.touched.clear();
+
+	row.xs.push_back(x);
+	row.sets.push_back(set);
+}
+
+rc::Pvs rc::build_pvs(const Map& map, Workers& workers){
+	RC_DIE(static_cast<uint64_t>(map.w) * map.h > PVS_MAX_CELLS, "map past PVS_MAX_CELLS cells, too big for a pvs");
+
+	std::vector<Pvs_view> views;
+	for(int q = 0; q < 4; q++){
+		views.emplace_back(map, q);
+	}
+
+	std::atomic<uint64_t> words(0);
+	std::vector<Pvs_row> rows(map.h);
+	std::vector<Pvs_scratch> scratch(workers.count());
+	for(auto& s : scratch){
+		s.seen.assign(static_cast<size_t>(map.w) * map.h, 0);
+	}
+
+	workers.run(map.h, [&](int y, int worker){
+		for(int x = 0; x < map.w; x++){
+			if(!(map.at(x, y) & WALL_BIT)){
+				build_cell(map, views, scratch[worker], x, y, rows[y], words);
+			}
+		}
+	});
+
+	auto data = std::make_shared<Pvs_data>();
+	data->cell_sets.assign(static_cast<size_t>(map.w) * map.h, PVS_NONE);
+	for(int y = 0; y < map.h; y++){
+		for(size_t i = 0; i < rows[y].sets.size(); i++){
+			Pvs_set set = rows[y].sets[i];
+			set.bits += data->bits.size();
+			data->cell_sets[y * map.w + rows[y].xs[i]] = data->sets.size();
+			data->sets.push_back(set);
+		}
+		data->bits.insert(data->bits.end(), rows[y].bits.begin(), rows[y].bits.end());
+		rows[y] = Pvs_row();
+	}
+
+	Pvs pvs;
+	pvs.w = map.w;
+	pvs.h = map.h;
+	pvs.cell_sets = data->cell_sets.data();
+	pvs.sets = data->sets.data();
+	pvs.bits = data->bits.data();
+	pvs.set_count = data->sets.size();
+	pvs.bit_words = data->bits.size();
+	pvs.storage = data;
+	return pvs;
+}
@@ -0,0 +1,328 @@
+#include "ray_packet.h"
+#include "map.h"
+
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RC_PACKET_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * Values every lane starts from. All rays of a packet share the origin, so the starting cell
+ * and the distance from the origin to the grid lines around it are computed once here, in
+ * the same float operations for every instruction set.
+ * */
+struct Packet_setup{
+	int map_x, map_y;
+	int cell;                       // Map::index() of the starting cell.
+	float first_x_neg, first_x_pos; // distance to the vertical lines left and right of the origin.
+	float first_y_neg, first_y_pos; // distance to the horizontal lines above and below it.
+};
+
+static Packet_setup packet_setup(const rc::Packet_grid& grid, const rc::Ray_packet& rays){
+	Packet_setup s;
+	s.map_x = static_cast<int>(rays.origin_x / grid.cell_size);
+	s.map_y = static_cast<int>(rays.origin_y / grid.cell_size);
+	s.cell = (((s.map_y >> MAP_CHUNK_SHIFT) * grid.chunks_w + (s.map_x >> MAP_CHUNK_SHIFT)) << (2 * MAP_CHUNK_SHIFT)) +
+			 ((s.map_y & MAP_CHUNK_MASK) << MAP_CHUNK_SHIFT) + (s.map_x & MAP_CHUNK_MASK);
+
+	s.first_x_neg = rays.origin_x - static_cast<float>(s.map_x) * grid.cell_size;
+	s.first_x_pos = static_cast<float>(s.map_x + 1) * grid.cell_size - rays.origin_x;
+	s.first_y_neg = rays.origin_y - static_cast<float>(s.map_y) * grid.cell_size;
+	s.first_y_pos = static_cast<float>(s.map_y + 1) * grid.cell_size - rays.origin_y;
+	return s;
+}
+
+static void trace_scalar(const rc::Packet_grid& grid, const rc::Ray_packet& rays, rc::Packet_hits& hits){
+	Packet_setup s = packet_setup(grid, rays);
+
+	// locals, visited is a byte pointer and the stores through it could alias everything else.
+	const uint32_t * cells = grid.cells;
+	uint8_t * visited = grid.visited;
+	const int w = grid.w, h = grid.h;
+
+	for(int lane = 0; lane < rays.count; lane++){
+		float dir_x = rays.dir_x[lane];
+		float dir_y = rays.dir_y[lane];
+
+		int step_x = dir_x < 0.0f ? -1 : 1;
+		int step_y = dir_y < 0.0f ? -1 : 1;
+
+		// a zero component gives an infinite delta, so that axis never gets crossed.
+		float delta_x = grid.cell_size / fabsf(dir_x);
+		float delta_y = grid.cell_size / fabsf(dir_y);
+
+		float side_x = (dir_x < 0.0f ? s.first_x_neg : s.first_x_pos) / fabsf(dir_x);
+		float side_y = (dir_y < 0.0f ? s.first_y_neg : s.first_y_pos) / fabsf(dir_y);
+
+		int map_x = s.map_x;
+		int map_y = s.map_y;
+		int cell = s.cell;
+
+		/* The cell index is stepped along with map_x and map_y. Inside a chunk a step is +-1 along
+		 * x and +-MAP_CHUNK_SIZE along y, only a step that wraps the position within the chunk (to 0
+		 * going forward, to MAP_CHUNK_MASK going back) moves on to the neighbouring chunk.*/
+		const int wrap_x = step_x > 0 ? 0 : MAP_CHUNK_MASK;
+		const int wrap_y = step_y > 0 ? 0 : MAP_CHUNK_MASK;
+		const int cross_x = step_x * (MAP_CHUNK_CELLS - MAP_CHUNK_MASK);
+		const int cross_y = step_y * (grid.chunks_w * MAP_CHUNK_CELLS - MAP_CHUNK_MASK * MAP_CHUNK_SIZE);
+		const int row_y = step_y * MAP_CHUNK_SIZE;
+
+		float t;
+		bool vertical;
+		bool wall = false;
+
+		while(true){
+			vertical = side_x < side_y;
+			t = vertical ? side_x : side_y;
+
+			if(vertical){
+				side_x += delta_x;
+				map_x += step_x;
+				cell += (map_x & MAP_CHUNK_MASK) == wrap_x ? cross_x : step_x;
+			}else{
+				side_y += delta_y;
+				map_y += step_y;
+				cell += (map_y & MAP_CHUNK_MASK) == wrap_y ? cross_y : row_y;
+			}
+
+			if(map_x < 0 || map_x >= w || map_y < 0 || map_y >= h){
+				break;
+			}else if(cells[cell] & WALL_BIT){
+				wall = true;
+				break;
+			}else{
+				visited[cell] = 1;
+			}
+		}
+
+		hits.t[lane] = t;
+		hits.vertical[lane] = vertical ? -1 : 0;
+		hits.cell_x[lane] = wall ? map_x : -1;
+		hits.cell_y[lane] = wall ? map_y : -1;
+	}
+}
+
+#ifdef RC_PACKET_X86
+
+/*
+ * 4 lanes of the scalar walk above. Lanes keep stepping after they hit something, their
+ * results are latched when they finish and active only masks the outputs, so the stepping
+ * never waits on the cell loads of the previous step. The cell index is rebuilt from map_x
+ * and map_y every step instead of stepped like the scalar walk: the chunk crossing blends
+ * need six more constant registers than there are, and the spills cost more than the shifts.
+ * sse has no gather, the cells are loaded one lane at a time.
+ * */
+__attribute__((target("sse4.1")))
+static void trace_sse(const rc::Packet_grid& grid, const rc::Ray_packet& rays, rc::Packet_hits& hits){
+	Packet_setup s = packet_setup(grid, rays);
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 cell_size = _mm_set1_ps(grid.cell_size);
+
+	__m128 dir_x = _mm_load_ps(rays.dir_x);
+	__m128 dir_y = _mm_load_ps(rays.dir_y);
+	__m128 abs_x = _mm_and_ps(dir_x, abs_mask);
+	__m128 abs_y = _mm_and_ps(dir_y, abs_mask);
+	__m128 neg_x = _mm_cmplt_ps(dir_x, zero);
+	__m128 neg_y = _mm_cmplt_ps(dir_y, zero);
+
+	const __m128i step_x = _mm_blendv_epi8(_mm_set1_epi32(1), _mm_set1_epi32(-1), _mm_castps_si128(neg_x));
+	const __m128i step_y = _mm_blendv_epi8(_mm_set1_epi32(1), _mm_set1_epi32(-1), _mm_castps_si128(neg_y));
+	const __m128i chunk_mask = _mm_set1_epi32(MAP_CHUNK_MASK);
+	const __m128i chunk_row = _mm_set1_epi32(grid.chunks_w << (2 * MAP_CHUNK_SHIFT));
+
+	const __m128 delta_x = _mm_div_ps(cell_size, abs_x);
+	const __m128 delta_y = _mm_div_ps(cell_size, abs_y);
+
+	__m128 side_x = _mm_div_ps(_mm_blendv_ps(_mm_set1_ps(s.first_x_pos), _mm_set1_ps(s.first_x_neg), neg_x), abs_x);
+	__m128 side_y = _mm_div_ps(_mm_blendv_ps(_mm_set1_ps(s.first_y_pos), _mm_set1_ps(s.first_y_neg), neg_y), abs_y);
+
+	__m128i map_x = _mm_set1_epi32(s.map_x);
+	__m128i map_y = _mm_set1_epi32(s.map_y);
+
+	const __m128i max_x = _mm_set1_epi32(grid.w - 1);
+	const __m128i max_y = _mm_set1_epi32(grid.h - 1);
+	const __m128i spare = _mm_set1_epi32(grid.visited_spare);
+	const __m128i wall_bit = _mm_set1_epi32(WALL_BIT);
+	const __m128i izero = _mm_setzero_si128();
+
+	__m128i active = _mm_cmpgt_epi32(_mm_set1_epi32(rays.count), _mm_setr_epi32(0, 1, 2, 3));
+	__m128 t_out = zero;
+	__m128i vertical_out = izero;
+	__m128i cell_x_out = _mm_set1_epi32(-1);
+	__m128i cell_y_out = _mm_set1_epi32(-1);
+
+	while(!_mm_testz_si128(active, active)){
+		__m128 vertical = _mm_cmplt_ps(side_x, side_y);
+		__m128i vertical_i = _mm_castps_si128(vertical);
+		__m128 t = _mm_blendv_ps(side_y, side_x, vertical);
+
+		side_x = _mm_add_ps(side_x, _mm_and_ps(delta_x, vertical));
+		side_y = _mm_add_ps(side_y, _mm_andnot_ps(vertical, delta_y));
+		map_x = _mm_add_epi32(map_x, _mm_and_si128(step_x, vertical_i));
+		map_y = _mm_add_epi32(map_y, _mm_andnot_si128(vertical_i, step_y));
+		__m128i cell = _mm_add_epi32(_mm_mullo_epi32(_mm_srai_epi32(map_y, MAP_CHUNK_SHIFT), chunk_row),
+									 _mm_slli_epi32(_mm_andnot_si128(chunk_mask, map_x), MAP_CHUNK_SHIFT));
+		cell = _mm_add_epi32(cell, _mm_add_epi32(_mm_slli_epi32(_mm_and_si128(map_y, chunk_mask), MAP_CHUNK_SHIFT),
+												 _mm_and_si128(map_x, chunk_mask)));
+
+		__m128i out = _mm_or_si128(_mm_or_si128(_mm_cmpgt_epi32(izero, map_x), _mm_cmpgt_epi32(map_x, max_x)),
+								   _mm_or_si128(_mm_cmpgt_epi32(izero, map_y), _mm_cmpgt_epi32(map_y, max_y)));
+
+		// lanes outside the map read cell 0 instead.
+		__m128i index = _mm_andnot_si128(out, cell);
+		__m128i cells = _mm_setr_epi32(grid.cells[_mm_extract_epi32(index, 0)], grid.cells[_mm_extract_epi32(index, 1)],
+									   grid.cells[_mm_extract_epi32(index, 2)], grid.cells[_mm_extract_epi32(index, 3)]);
+
+		__m128i wall = _mm_andnot_si128(out, _mm_cmpeq_epi32(_mm_and_si128(cells, wall_bit), wall_bit));
+		__m128i stop = _mm_or_si128(out, wall);
+		__m128i done = _mm_and_si128(stop, active);
+
+		t_out = _mm_blendv_ps(t_out, t, _mm_castsi128_ps(done));
+		vertical_out = _mm_blendv_epi8(vertical_out, vertical_i, done);
+		cell_x_out = _mm_blendv_epi8(cell_x_out, map_x, _mm_and_si128(wall, active));
+		cell_y_out = _mm_blendv_epi8(cell_y_out, map_y, _mm_and_si128(wall, active));
+
+		// lanes that are not on a floor cell write the spare byte, so the scatter needs no branches.
+		__m128i mark = _mm_blendv_epi8(spare, cell, _mm_andnot_si128(stop, active));
+		grid.visited[_mm_extract_epi32(mark, 0)] = 1;
+		grid.visited[_mm_extract_epi32(mark, 1)] = 1;
+		grid.visited[_mm_extract_epi32(mark, 2)] = 1;
+		grid.visited[_mm_extract_epi32(mark, 3)] = 1;
+
+		active = _mm_andnot_si128(stop, active);
+	}
+
+	_mm_store_ps(hits.t, t_out);
+	_mm_store_si128(reinterpret_cast<__m128i *>(hits.vertical), vertical_out);
+	_mm_store_si128(reinterpret_cast<__m128i *>(hits.cell_x), cell_x_out);
+	_mm_store_si128(reinterpret_cast<__m128i *>(hits.cell_y), cell_y_out);
+}
+
+/* 8 lanes, same as trace_sse() with the cells fetched by a masked gather.*/
+__attribute__((target("avx2")))
+static void trace_avx2(const rc::Packet_grid& grid, const rc::Ray_packet& rays, rc::Packet_hits& hits){
+	Packet_setup s = packet_setup(grid, rays);
+
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	const __m256 cell_size = _mm256_set1_ps(grid.cell_size);
+
+	__m256 dir_x = _mm256_load_ps(rays.dir_x);
+	__m256 dir_y = _mm256_load_ps(rays.dir_y);
+	__m256 abs_x = _mm256_and_ps(dir_x, abs_mask);
+	__m256 abs_y = _mm256_and_ps(dir_y, abs_mask);
+	__m256 neg_x = _mm256_cmp_ps(dir_x, zero, _CMP_LT_OQ);
+	__m256 neg_y = _mm256_cmp_ps(dir_y, zero, _CMP_LT_OQ);
+
+	const __m256i step_x = _mm256_blendv_epi8(_mm256_set1_epi32(1), _mm256_set1_epi32(-1), _mm256_castps_si256(neg_x));
+	const __m256i step_y = _mm256_blendv_epi8(_mm256_set1_epi32(1), _mm256_set1_epi32(-1), _mm256_castps_si256(neg_y));
+	const __m256i chunk_mask = _mm256_set1_epi32(MAP_CHUNK_MASK);
+	const __m256i chunk_row = _mm256_set1_epi32(grid.chunks_w << (2 * MAP_CHUNK_SHIFT));
+
+	const __m256 delta_x = _mm256_div_ps(cell_size, abs_x);
+	const __m256 delta_y = _mm256_div_ps(cell_size, abs_y);
+
+	__m256 side_x = _mm256_div_ps(_mm256_blendv_ps(_mm256_set1_ps(s.first_x_pos), _mm256_set1_ps(s.first_x_neg), neg_x), abs_x);
+	__m256 side_y = _mm256_div_ps(_mm256_blendv_ps(_mm256_set1_ps(s.first_y_pos), _mm256_set1_ps(s.first_y_neg), neg_y), abs_y);
+
+	__m256i map_x = _mm256_set1_epi32(s.map_x);
+	__m256i map_y = _mm256_set1_epi32(s.map_y);
+
+	const __m256i max_x = _mm256_set1_epi32(grid.w - 1);
+	const __m256i max_y = _mm256_set1_epi32(grid.h - 1);
+	const __m256i spare = _mm256_set1_epi32(grid.visited_spare);
+	const __m256i wall_bit = _mm256_set1_epi32(WALL_BIT);
+	const __m256i izero = _mm256_setzero_si256();
+
+	__m256i active = _mm256_cmpgt_epi32(_mm256_set1_epi32(rays.count), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	__m256 t_out = zero;
+	__m256i vertical_out = izero;
+	__m256i cell_x_out = _mm256_set1_epi32(-1);
+	__m256i cell_y_out = _mm256_set1_epi32(-1);
+
+	alignas(32) int32_t mark[8];
+
+	while(!_mm256_testz_si256(active, active)){
+		__m256 vertical = _mm256_cmp_ps(side_x, side_y, _CMP_LT_OQ);
+		__m256i vertical_i = _mm256_castps_si256(vertical);
+		__m256 t = _mm256_blendv_ps(side_y, side_x, vertical);
+
+		side_x = _mm256_add_ps(side_x, _mm256_and_ps(delta_x, vertical));
+		side_y = _mm256_add_ps(side_y, _mm256_andnot_ps(vertical, delta_y));
+		map_x = _mm256_add_epi32(map_x, _mm256_and_si256(step_x, vertical_i));
+		map_y = _mm256_add_epi32(map_y, _mm256_andnot_si256(vertical_i, step_y));
+		__m256i cell = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srai_epi32(map_y, MAP_CHUNK_SHIFT), chunk_row),
+										_mm256_slli_epi32(_mm256_andnot_si256(chunk_mask, map_x), MAP_CHUNK_SHIFT));
+		cell = _mm256_add_epi32(cell, _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(map_y, chunk_mask), MAP_CHUNK_SHIFT),
+													   _mm256_and_si256(map_x, chunk_mask)));
+
+		__m256i out = _mm256_or_si256(_mm256_or_si256(_mm256_cmpgt_epi32(izero, map_x), _mm256_cmpgt_epi32(map_x, max_x)),
+									  _mm256_or_si256(_mm256_cmpgt_epi32(izero, map_y), _mm256_cmpgt_epi32(map_y, max_y)));
+
+		__m256i cells = _mm256_mask_i32gather_epi32(izero, reinterpret_cast<const int *>(grid.cells),
+													_mm256_andnot_si256(out, cell), _mm256_andnot_si256(out, active), 4);
+
+		__m256i wall = _mm256_andnot_si256(out, _mm256_cmpeq_epi32(_mm256_and_si256(cells, wall_bit), wall_bit));
+		__m256i stop = _mm256_or_si256(out, wall);
+		__m256i done = _mm256_and_si256(stop, active);
+
+		t_out = _mm256_blendv_ps(t_out, t, _mm256_castsi256_ps(done));
+		vertical_out = _mm256_blendv_epi8(vertical_out, vertical_i, done);
+		cell_x_out = _mm256_blendv_epi8(cell_x_out, map_x, _mm256_and_si256(wall, active));
+		cell_y_out = _mm256_blendv_epi8(cell_y_out, map_y, _mm256_and_si256(wall, active));
+
+		// lanes that are not on a floor cell write the spare byte, so the scatter needs no branches.
+		_mm256_store_si256(reinterpret_cast<__m256i *>(mark), _mm256_blendv_epi8(spare, cell, _mm256_andnot_si256(stop, active)));
+		for(int i = 0; i < 8; i++){
+			grid.visited[mark[i]] = 1;
+		}
+
+		active = _mm256_andnot_si256(stop, active);
+	}
+
+	_mm256_store_ps(hits.t, t_out);
+	_mm256_store_si256(reinterpret_cast<__m256i *>(hits.vertical), vertical_out);
+	_mm256_store_si256(reinterpret_cast<__m256i *>(hits.cell_x), cell_x_out);
+	_mm256_store_si256(reinterpret_cast<__m256i *>(hits.cell_y), cell_y_out);
+}
+
+#endif
+
+rc::Packet_isa rc::best_packet_isa(){
+#ifdef RC_PACKET_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) return PACKET_AVX2;
+	if(__builtin_cpu_supports("sse4.1")) return PACKET_SSE;
+#endif
+	return PACKET_SCALAR;
+}
+
+int rc::packet_width(Packet_isa isa){
+	switch(isa){
+		case PACKET_AVX2: return 8;
+		case PACKET_SSE: return 4;
+		default: return 1;
+	}
+}
+
+const char * rc::packet_isa_name(Packet_isa isa){
+	switch(isa){
+		case PACKET_AVX2: return "avx2";
+		case PACKET_SSE: return "sse";
+		default: return "scalar";
+	}
+}
+
+void rc::trace_packet(Packet_isa isa, const Packet_grid& grid, const Ray_packet& rays, Packet_hits& hits){
+	assert(rays.count > 0 && rays.count <= packet_width(isa));
+
+#ifdef RC_PACKET_X86
+	if(isa == PACKET_AVX2) return trace_avx2(grid, rays, hits);
+	if(isa == PACKET_SSE) return trace_sse(grid, rays, hits);
+#endif
+	trace_scalar(grid, rays, hits);
+}
@@ -0,0 +1,121 @@
+#include "transpose.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RC_TRANSPOSE_X86
+#include <immintrin.h>
+#endif
+
+/* Tiles are transposed a block at a time, so the block's source rows and destination rows both
+ * stay in L2: 128 * 128 * 4 bytes, 64KB on each side. Smaller blocks were slower at 1080p, the
+ * destination rows there land on a handful of L1 sets anyway.*/
+#define BLOCK 128
+
+typedef void (*Tile_fn)(const uint32_t * src, size_t src_stride, uint32_t * dst, size_t dst_stride);
+
+static void transpose_edge(const uint32_t * src, size_t src_stride, uint32_t * dst, size_t dst_stride,
+						   int r0, int r1, int c0, int c1){
+	for(int r = r0; r < r1; r++){
+		for(int c = c0; c < c1; c++){
+			dst[c * dst_stride + r] = src[r * src_stride + c];
+		}
+	}
+}
+
+static void transpose_blocked(const uint32_t * src, size_t src_stride, uint32_t * dst, size_t dst_stride,
+							  int rows, int cols, int tile, Tile_fn tile_fn){
+	int tiled_rows = rows - rows % tile;
+	int tiled_cols = cols - cols % tile;
+
+	for(int br = 0; br < tiled_rows; br += BLOCK){
+		for(int bc = 0; bc < tiled_cols; bc += BLOCK){
+			int r_end = std::min(br + BLOCK, tiled_rows);
+			int c_end = std::min(bc + BLOCK, tiled_cols);
+
+			for(int r = br; r < r_end; r += tile){
+				for(int c = bc; c < c_end; c += tile){
+					tile_fn(src + r * src_stride + c, src_stride, dst + c * dst_stride + r, dst_stride);
+				}
+			}
+		}
+	}
+
+	transpose_edge(src, src_stride, dst, dst_stride, 0, tiled_rows, tiled_cols, cols);
+	transpose_edge(src, src_stride, dst, dst_stride, tiled_rows, rows, 0, cols);
+}
+
+#ifdef RC_TRANSPOSE_X86
+
+static void tile_sse(const uint32_t * src, size_t src_stride, uint32_t * dst, size_t dst_stride){
+	__m128 r0 = _mm_loadu_ps(reinterpret_cast<const float *>(src));
+	__m128 r1 = _mm_loadu_ps(reinterpret_cast<const float *>(src + src_stride));
+	__m128 r2 = _mm_loadu_ps(reinterpret_cast<const float *>(src + src_stride * 2));
+	__m128 r3 = _mm_loadu_ps(reinterpret_cast<const float *>(src + src_stride * 3));
+
+	_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+	_mm_storeu_ps(reinterpret_cast<float *>(dst), r0);
+	_mm_storeu_ps(reinterpret_cast<float *>(dst + dst_stride), r1);
+	_mm_storeu_ps(reinterpret_cast<float *>(dst + dst_stride * 2), r2);
+	_mm_storeu_ps(reinterpret_cast<float *>(dst + dst_stride * 3), r3);
+}
+
+/* The usual three rounds: interleave pairs of 32 bit lanes, then 64 bit lanes, then swap the
+ * 128 bit halves.*/
+__attribute__((target("avx2")))
+static void tile_avx2(const uint32_t * src, size_t src_stride, uint32_t * dst, size_t dst_stride){
+	const float * s = reinterpret_cast<const float *>(src);
+	float * d = reinterpret_cast<float *>(dst);
+
+	__m256 r0 = _mm256_loadu_ps(s);
+	__m256 r1 = _mm256_loadu_ps(s + src_stride);
+	__m256 r2 = _mm256_loadu_ps(s + src_stride * 2);
+	__m256 r3 = _mm256_loadu_ps(s + src_stride * 3);
+	__m256 r4 = _mm256_loadu_ps(s + src_stride * 4);
+	__m256 r5 = _mm256_loadu_ps(s + src_stride * 5);
+	__m256 r6 = _mm256_loadu_ps(s + src_stride * 6);
+	__m256 r7 = _mm256_loadu_ps(s + src_stride * 7);
+
+	__m256 t0 = _mm256_unpacklo_ps(r0, r1);
+	__m256 t1 = _mm256_unpackhi_ps(r0, r1);
+	__m256 t2 = _mm256_unpacklo_ps(r2, r3);
+	__m256 t3 = _mm256_unpackhi_ps(r2, r3);
+	__m256 t4 = _mm256_unpacklo_ps(r4, r5);
+	__m256 t5 = _mm256_unpackhi_ps(r4, r5);
+	__m256 t6 = _mm256_unpacklo_ps(r6, r7);
+	__m256 t7 = _mm256_unpackhi_ps(r6, r7);
+
+	r0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+	r1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+	r2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+	r3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+	r4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+	r5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+	r6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+	r7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+	_mm256_storeu_ps(d, _mm256_permute2f128_ps(r0, r4, 0x20));
+	_mm256_storeu_ps(d + dst_stride, _mm256_permute2f128_ps(r1, r5, 0x20));
+	_mm256_storeu_ps(d + dst_stride * 2, _mm256_permute2f128_ps(r2, r6, 0x20));
+	_mm256_storeu_ps(d + dst_stride * 3, _mm256_permute2f128_ps(r3, r7, 0x20));
+	_mm256_storeu_ps(d + dst_stride * 4, _mm256_permute2f128_ps(r0, r4, 0x31));
+	_mm256_storeu_ps(d + dst_stride * 5, _mm256_permute2f128_ps(r1, r5, 0x31));
+	_mm256_storeu_ps(d + dst_stride * 6, _mm256_permute2f128_ps(r2, r6, 0x31));
+	_mm256_storeu_ps(d + dst_stride * 7, _mm256_permute2f128_ps(r3, r7, 0x31));
+}
+
+#endif
+
+void rc::transpose_pixels(const uint32_t * src, size_t src_stride, uint32_t * dst, size_t dst_stride, int rows, int cols){
+#ifdef RC_TRANSPOSE_X86
+	static const bool avx2 = __builtin_cpu_supports("avx2");
+	if(avx2){
+		transpose_blocked(src, src_stride, dst, dst_stride, rows, cols, 8, tile_avx2);
+	}else{
+		transpose_blocked(src, src_stride, dst, dst_stride, rows, cols, 4, tile_sse);
+	}
+#else
+	transpose_edge(src, src_stride, dst, dst_stride, 0, rows, 0, cols);
+#endif
+}
@@ -0,0 +1,112 @@
+/*
+ * Writes map files for rc::load_map_file(), see map_file.h for the format.
+ *
+ * The level comes either from one of the bench maps or straight from the generator in
+ * map_gen.h, --info prints the header of an existing file. Sprites get the bench textures,
+ * the spawn is the bench map's first camera key or the generator's spawn. --pvs builds the
+ * potentially visible sets, see pvs.h, on every core and stores them in the file too.
+ *
+ * usage: map_convert --bench name [--pvs] out.rcmap
+ *        map_convert --gen WxH [--seed n] [--density d] [--corridor n] [--open r] [--sprites n] [--pvs] out.rcmap
+ *        map_convert --info file.rcmap
+ * */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "bench.h"
+#include "map_file.h"
+#include "map_gen.h"
+
+static int usage(const char * name){
+	fprintf(stderr, "usage: %s --bench name [--pvs] out.rcmap\n"
+					"       %s --gen WxH [--seed n] [--density d] [--corridor n] [--open r] [--sprites n] [--pvs] out.rcmap\n"
+					"       %s --info file.rcmap\n", name, name, name);
+	return 1;
+}
+
+static std::vector<uint32_t> sprite_textures(size_t count){
+	std::vector<uint32_t> textures(count);
+	for(size_t i = 0; i < count; i++){
+		textures[i] = rc::bench_sprite_texture(i);
+	}
+	return textures;
+}
+
+static void print_info(const char * path){
+	rc::Map_file file = rc::load_map_file(path);
+	printf("%s: version %d, %dx%d cells in %dx%d chunks, %u sprites, spawn %.1f %.1f\n", path, MAP_FILE_VERSION,
+		   file.map.w, file.map.h, file.map.chunks_w, file.map.chunks_h, file.sprite_count, file.spawn.x, file.spawn.y);
+	printf("textures:");
+	for(uint32_t i = 0; i < file.texture_count; i++){
+		printf(" %u", file.textures[i]);
+	}
+	printf("\n");
+	if(file.map.pvs){
+		printf("pvs: %u sets, %llu KiB of bits\n", file.map.pvs->set_count,
+			   static_cast<unsigned long long>(file.map.pvs->bit_words * sizeof(uint64_t) / 1024));
+	}
+}
+
+static void add_pvs(rc::Map& map){
+	// the same limit build_pvs() dies on, checked before the workers are started.
+	RC_DIE(static_cast<uint64_t>(map.w) * map.h > PVS_MAX_CELLS, "map past PVS_MAX_CELLS cells, too big for --pvs");
+	rc::Workers workers(std::thread::hardware_concurrency());
+	auto start = std::chrono::steady_clock::now();
+	map.pvs = std::make_shared<rc::Pvs>(rc::build_pvs(map, workers));
+	printf("pvs built in %.0f ms\n", rc::elapsed_ms(start));
+}
+
+int main(int argc, char ** argv){
+	const char * bench = NULL;
+	const char * gen = NULL;
+	const char * info = NULL;
+	const char * out = NULL;
+	bool pvs = false;
+	rc::Map_gen_params params;
+
+	for(int i = 1; i < argc; i++){
+		if(!strcmp(argv[i], "--bench") && i + 1 < argc) bench = argv[++i];
+		else if(!strcmp(argv[i], "--gen") && i + 1 < argc) gen = argv[++i];
+		else if(!strcmp(argv[i], "--info") && i + 1 < argc) info = argv[++i];
+		else if(!strcmp(argv[i], "--seed") && i + 1 < argc) params.seed = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--density") && i + 1 < argc) params.wall_density = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--corridor") && i + 1 < argc) params.corridor_length = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--open") && i + 1 < argc) params.open_ratio = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--sprites") && i + 1 < argc) params.sprites = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "--pvs")) pvs = true;
+		else if(argv[i][0] != '-' && !out) out = argv[i];
+		else return usage(argv[0]);
+	}
+
+	if(info){
+		print_info(info);
+		return 0;
+	}
+
+	if(!out || !gen == !bench) return usage(argv[0]);
+
+	if(gen){
+		RC_DIE(sscanf(gen, "%dx%d", &params.w, &params.h) != 2, "bad --gen");
+		RC_DIE(params.w <= 0 || params.h <= 0 || params.w > MAP_MAX_SIZE || params.h > MAP_MAX_SIZE, "bad --gen size");
+
+		auto map = rc::generate_map(params);
+		if(pvs) add_pvs(map.map);
+		rc::save_map_file(out, map.map, map.spawn, map.sprites, sprite_textures(map.sprites.size()));
+	}else{
+		bool found = false;
+		for(const auto& map : rc::bench_maps()){
+			if(map.name != bench) continue;
+
+			rc::Vec2f spawn(map.path[0].x, map.path[0].y);
+			rc::Map values(&map.values[0], map.w, map.h);
+			if(pvs) add_pvs(values);
+			rc::save_map_file(out, values, spawn, map.sprites, sprite_textures(map.sprites.size()));
+			found = true;
+		}
+		RC_DIE(!found, "unknown bench map");
+	}
+
+	print_info(out);
+	return 0;
+}